@@ -0,0 +1,42 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <gravm/runstack.h>
+
+/* memoized subgraph results. an edge is cacheable if callback.fingerprint returns GRAVM_RS_TRUE for it; the child
+ * frame produced by executing the edge is then stored under (program, edge id, fingerprint). if the same key is seen
+ * again, the stored child frame is handed to callback.ascend instead of executing the subgraph.
+ * a cache may be used by any number of runstacks (see gravm_runstack_set_cache()), also from different threads.
+ * entries are only shared by runstacks executing the same program (see gravm_runstack_prepare_program() and
+ * gravm/program.h); separately compiled, mapped or edited programs never hit each other's entries. bindings made by
+ * gravm_program_call() are not part of the key.
+ * the edge mask is part of the key as well: entries stored while a mask is set are only found by runstacks using the
+ * mask of the same gravm_runstack_set_edge_mask() call (so after changing bits of a mask in place, set it again).
+ * edges added by gravm_runstack_emit() are not part of the key; callback.fingerprint must cover whatever they depend
+ * on.
+ * entries are evicted using the CLOCK algorithm once the memory budget is exhausted */
+
+typedef struct gravm_cache gravm_cache_t;
+
+/* 'max_bytes' limits the memory used by entries, including bookkeeping. sets errno in case NULL is returned */
+gravm_cache_t *gravm_cache_new(
+		size_t max_bytes);
+
+/* all runstacks using the cache must have been destroyed (or have another cache set) before */
+void gravm_cache_destroy(
+		gravm_cache_t *self);
+
+void gravm_cache_clear(
+		gravm_cache_t *self);
+
+/* memory currently used by entries */
+size_t gravm_cache_bytes(
+		gravm_cache_t *self);
+
+/* number of lookups which did / did not find an entry */
+void gravm_cache_stats(
+		gravm_cache_t *self,
+		unsigned long *hits,
+		unsigned long *misses);
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <gravm/runstack.h>
+
+enum {
+	GRAVM_PROGRAM_DEFAULT = 0,
+	GRAVM_PROGRAM_PARALLEL = 0x0001, /* sort and derive node ranges using multiple threads */
+	GRAVM_PROGRAM_STRUCTURE_THREADSAFE = 0x0002, /* callback.structure may be called concurrently for different edges */
+	GRAVM_PROGRAM_LAYOUT_DFS = 0x0004 /* place the edges in the order a depth-first run visits them; edge ids are not affected */
+};
+
+/* compiled, immutable representation of the edges delivered by callback.init/structure.
+ * a program may be shared by any number of runstacks (see gravm_runstack_prepare_program()).
+ * only a program compiled by gravm_runstack_prepare() can be edited, through that runstack: an edit costs O(log n)
+ * (amortized), the edits since the previous run are merged into the compiled edges in O(n + k log k) for k edits
+ * when the next run starts, see gravm_runstack_edge_add() */
+
+/* uses callback.init and callback.structure only; sets errno in case NULL is returned */
+gravm_program_t *gravm_program_new(
+		const gravm_runstack_callback_t *cb,
+		void *user,
+		int flags);
+
+/* stores payloads of the given sizes next to each edge and node, see gravm_runstack_new_payload() */
+gravm_program_t *gravm_program_new_payload(
+		const gravm_runstack_callback_t *cb,
+		void *user,
+		int flags,
+		int edge_payload_size,
+		int node_payload_size);
+
+void gravm_program_destroy(
+		gravm_program_t *self);
+
+/* number of edges, including those added or removed by gravm_runstack_edge_add()/edge_remove() since the last run */
+int gravm_program_size(
+		gravm_program_t *self);
+
+/* maximum stack size (number of frames) needed to execute the program depth-first, i.e. the longest chain of edges
+ * starting at the root, not including called programs (see gravm_program_call()); -ELOOP if a cycle is reachable from
+ * the root. the first call after the program has been created or changed walks all edges, later calls are cheap */
+int gravm_program_max_depth(
+		gravm_program_t *self);
+
+int gravm_program_edge_payload_size(
+		gravm_program_t *self);
+
+int gravm_program_node_payload_size(
+		gravm_program_t *self);
+
+/* makes 'node' call 'callee': when a runstack executes 'self' depth-first, the root edges of 'callee' are executed
+ * like outgoing edges of 'node', after all of its post edges. their frames have the frame of 'node' as parent, and
+ * the callee's edges below are taken from 'callee' itself, so a compiled subgraph can be shared by any number of
+ * call sites and programs without copying its edges. callee edges are neither prepared by the caller nor subject to
+ * the runstack's edge mask, caching, incremental execution or GRAVM_RS_OPT_VISIT_ONCE, even if 'callee' is the
+ * runstack's program itself; level order and priority
+ * scheduling do not support calls. 'callee' is not owned and must outlive 'self'; the binding is not saved by
+ * gravm_program_save(). NULL removes the call. -ENOENT: unknown node */
+int gravm_program_call(
+		gravm_program_t *self,
+		int node,
+		gravm_program_t *callee);
+
+/* writes the program into fd using a position independent format which can later be used by gravm_program_map() */
+int gravm_program_save(
+		gravm_program_t *self,
+		int fd);
+
+/* maps a file written by gravm_program_save() read-only into memory. only the header is validated, the edge
+ * data is used as is, so the file must come from a trusted source. sets errno in case NULL is returned */
+gravm_program_t *gravm_program_map(
+		const char *path);
+
+/* mapped programs only: keeps at most about 'max_bytes' of the mapping resident. the outgoing edges of a node are
+ * paged in (madvise(MADV_WILLNEED)) when a runstack descends into it, together with those of its first children;
+ * once the limit is exceeded, the least recently used parts are dropped (MADV_DONTNEED) and read again from the
+ * backing file on their next use. allows executing programs larger than the available memory.
+ * 0: leave paging to the kernel (default). must not be called while a runstack executes the program.
+ * -EINVAL for programs which are not mapped */
+int gravm_program_set_residency(
+		gravm_program_t *self,
+		size_t max_bytes);
+
+/* copies the program into a sealed, anonymous shared memory segment and returns a read-only mapping of it.
+ * the mapping is inherited by fork()ed children; other processes can map the segment using gravm_program_attach()
+ * on a duplicate of gravm_program_fd(). 'self' may be destroyed afterwards. sets errno in case NULL is returned */
+gravm_program_t *gravm_program_share(
+		gravm_program_t *self);
+
+/* file descriptor of the shared memory segment, -ENOENT if the program has not been created by gravm_program_share() */
+int gravm_program_fd(
+		gravm_program_t *self);
+
+/* maps a shared memory segment (or any file written by gravm_program_save()) read-only.
+ * fd stays owned by the caller. sets errno in case NULL is returned */
+gravm_program_t *gravm_program_attach(
+		int fd);
+
+/***** versioning *****/
+
+/* a slot holds the most recent version of a program. publishing a new version does not affect
+ * runstacks which are still using an older one; old versions are destroyed once no runstack uses them anymore.
+ * only pinning/unpinning a version happens on the reader side, and that is lock-free */
+
+/* takes ownership of 'program'. sets errno in case NULL is returned */
+gravm_program_slot_t *gravm_program_slot_new(
+		gravm_program_t *program);
+
+/* all runstacks using the slot must have been destroyed (or prepared otherwise) before */
+void gravm_program_slot_destroy(
+		gravm_program_slot_t *self);
+
+/* makes 'program' the current version and takes ownership of it */
+int gravm_program_slot_publish(
+		gravm_program_slot_t *self,
+		gravm_program_t *program);
+
+/* destroys retired versions not in use anymore; returns the number of retired versions still in use.
+ * also done on every publish */
+int gravm_program_slot_reclaim(
+		gravm_program_slot_t *self);
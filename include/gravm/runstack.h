@@ -1,6 +1,7 @@
 #pragma once
 
 #include <stdbool.h>
+#include <stdint.h>
 #include <stdio.h>
 
 enum {
@@ -17,6 +18,16 @@ enum {
 	GRAVM_RS_UNKNOWN = -4
 };
 
+/* options for gravm_runstack_set_options() */
+enum {
+	GRAVM_RS_OPT_VISIT_ONCE = 0x0001, /* enter each node at most once per run; further visits call callback.node_revisit instead */
+	GRAVM_RS_OPT_INCREMENTAL = 0x0002, /* re-execute only edges leading to nodes which reach a dirty node, see gravm_runstack_mark_dirty() */
+	GRAVM_RS_OPT_LEVEL_ORDER = 0x0004, /* breadth-first execution, see gravm_runstack_run() */
+	GRAVM_RS_OPT_PRIORITY = 0x0008, /* execute ready edges by priority across the whole graph, see gravm_runstack_run() */
+	GRAVM_RS_OPT_PREALLOCATE = 0x0010, /* allocate all frames a depth-first run may need when preparing, see gravm_runstack_max_depth() */
+	GRAVM_RS_OPT_LAZY_PREPARE = 0x0020 /* prepare each outgoing edge right before descending into it, see gravm_runstack_set_options() */
+};
+
 enum {
 	GRAVM_RS_STATE_CREATED,
 	GRAVM_RS_STATE_PREPARED,
@@ -78,10 +89,20 @@ typedef struct {
 
 typedef struct gravm_runstack gravm_runstack_t;
 typedef struct gravm_runstack_callback gravm_runstack_callback_t;
+typedef struct gravm_program gravm_program_t;
+typedef struct gravm_trace gravm_trace_t;
+typedef struct gravm_program_slot gravm_program_slot_t;
+typedef struct gravm_cache gravm_cache_t;
 
 typedef int (*gravm_runstack_init_t)(void *user);
 typedef void (*gravm_runstack_destroy_t)(void *user);
 typedef int (*gravm_runstack_structure_t)(void *user, int edge, gravm_runstack_edgedef_t *def);
+typedef int (*gravm_runstack_edge_payload_t)(void *user, int edge, void *payload);
+typedef int (*gravm_runstack_node_payload_t)(void *user, int node, void *payload);
+typedef int (*gravm_runstack_node_revisit_t)(void *user, int id, void *framedata);
+typedef int (*gravm_runstack_fingerprint_t)(void *user, int edge, const void *parent_ctx, uint64_t *fingerprint);
+typedef int (*gravm_runstack_node_run_batch_t)(void *user, int n, const int *ids, void *const *framedata, int *results);
+typedef int (*gravm_runstack_node_run_lanes_t)(int n, void *const *users, const int *ids, void *const *framedata, int *results);
 
 typedef int (*gravm_runstack_descend_t)(void *user, int edge, void *parent_ctx, void *child_ctx);
 typedef int (*gravm_runstack_ascend_t)(void *user, int edge, bool throwing, int err, void *parent_ctx, void *child_ctx);
@@ -93,6 +114,9 @@ typedef int (*gravm_runstack_edge_next_t)(void *user, int iteration, int id, voi
 typedef int (*gravm_runstack_edge_end_t)(void *user, int id, void *context);
 typedef int (*gravm_runstack_edge_abort_t)(void *user, int err, int id, void *context);
 typedef int (*gravm_runstack_edge_catch_t)(void *user, int err, int id, void *context);
+typedef int (*gravm_runstack_edges_prepare_t)(void *user, int n, const int *ids, void *context);
+typedef int (*gravm_runstack_edges_unprepare_t)(void *user, int n, const int *ids, void *context);
+typedef int (*gravm_runstack_edges_abort_t)(void *user, int err, int n, const int *ids, void *context);
 
 typedef int (*gravm_runstack_node_enter_t)(void *user, int id, void *framedata);
 typedef int (*gravm_runstack_node_run_t)(void *user, int id, void *framedata);
@@ -104,7 +128,8 @@ struct gravm_runstack_callback {
 	gravm_runstack_destroy_t destroy;
 	gravm_runstack_structure_t structure;
 
-	/* descend/ascend: won't be called for root edges */
+	/* descend/ascend: also called for root edges, with a NULL parent_ctx (or the parent passed to
+	 * gravm_runstack_run_from()) */
 	gravm_runstack_descend_t descend;
 	gravm_runstack_ascend_t ascend;
 
@@ -128,6 +153,42 @@ struct gravm_runstack_callback {
 	gravm_runstack_node_run_t node_run;
 	gravm_runstack_node_leave_t node_leave;
 	gravm_runstack_node_catch_t node_catch; /* only method that may return THROW during throwing; replaces the error code with the one stored in errno after call; other methods will produce a fatal error when returning THROW during throwing */
+
+	/* optional, called during compilation to fill the (zero-initialized) payload of an edge or node,
+	 * see gravm_runstack_new_payload(). not set by GRAVM_RUNSTACK_MKCB() */
+	gravm_runstack_edge_payload_t edge_payload;
+	gravm_runstack_node_payload_t node_payload;
+
+	/* optional, GRAVM_RS_OPT_VISIT_ONCE only: called instead of node_enter/run/leave (and without descending into
+	 * outgoing edges) for a node which has already been entered during the current run. the edge is ended afterwards,
+	 * i.e. edge_next is not called. returns SUCCESS, THROW or FATAL. not set by GRAVM_RUNSTACK_MKCB() */
+	gravm_runstack_node_revisit_t node_revisit;
+
+	/* optional, only used if a cache has been set (see gravm_runstack_set_cache()). called before descending into
+	 * a non-root edge; returns GRAVM_RS_TRUE and sets *fingerprint if the child frame produced by the edge is fully
+	 * determined by the edge and *fingerprint, GRAVM_RS_FALSE if the edge must not be cached.
+	 * not set by GRAVM_RUNSTACK_MKCB() */
+	gravm_runstack_fingerprint_t fingerprint;
+
+	/* optional, GRAVM_RS_OPT_LEVEL_ORDER only: called instead of node_run with all 'n' nodes of a level, which may be
+	 * processed in parallel. stores GRAVM_RS_TRUE or GRAVM_RS_FALSE (as node_run would return) in results[0..n-1];
+	 * returns SUCCESS, THROW or FATAL. not set by GRAVM_RUNSTACK_MKCB() */
+	gravm_runstack_node_run_batch_t node_run_batch;
+
+	/* optional, gravm_runstack_run_batch() only: called instead of node_run with the nodes of all 'n' lanes still
+	 * running, once each of them has reached node_run. users[k] is the user context of the lane running node ids[k];
+	 * results and return value as for node_run_batch, a THROW applies to all 'n' lanes. not set by
+	 * GRAVM_RUNSTACK_MKCB() */
+	gravm_runstack_node_run_lanes_t node_run_lanes;
+
+	/* optional, replace edge_prepare/edge_unprepare/edge_abort if set: called once per node with the ids of all
+	 * 'n' outgoing edges concerned, in ascending order of execution (the per-edge variants unprepare and abort in
+	 * descending order). if edges_prepare or edges_unprepare throws, none of the edges counts as prepared anymore,
+	 * i.e. edges_abort is not called for them. gravm_runstack_edge_payload() refers to the current node's incoming
+	 * edge during these calls. not set by GRAVM_RUNSTACK_MKCB() */
+	gravm_runstack_edges_prepare_t edges_prepare;
+	gravm_runstack_edges_unprepare_t edges_unprepare;
+	gravm_runstack_edges_abort_t edges_abort;
 };
 
 /* sets errno in case NULL is returned */
@@ -136,6 +197,16 @@ gravm_runstack_t *gravm_runstack_new(
 		int max_stack_size,
 		int framedata_size);
 
+/* like gravm_runstack_new(), additionally stores a payload of the given size next to each compiled edge and node.
+ * payloads are filled by callback.edge_payload/node_payload and can be accessed from within any callback using
+ * gravm_runstack_edge_payload()/gravm_runstack_node_payload(). sets errno in case NULL is returned */
+gravm_runstack_t *gravm_runstack_new_payload(
+		const gravm_runstack_callback_t *cb,
+		int max_stack_size,
+		int framedata_size,
+		int edge_payload_size,
+		int node_payload_size);
+
 void gravm_runstack_destroy(
 		gravm_runstack_t *self);
 
@@ -147,10 +218,179 @@ int gravm_runstack_prepare(
 		gravm_runstack_t *self,
 		void *user);
 
-/* call again after vm has been suspended */
+/* GRAVM_RS_OPT_* flags; take effect with the next run. -EBUSY if called during execution.
+ * GRAVM_RS_OPT_LAZY_PREPARE: instead of preparing all outgoing edges before the pre edges and unpreparing them after
+ * the post edges, each edge is prepared right before it is descended into and unprepared right after it has been
+ * ascended from. edges which are not taken (e.g. post edges if node_run returns GRAVM_RS_FALSE) are neither prepared
+ * nor unprepared, and at most the edge currently descended into is aborted when throwing. depth-first only */
+int gravm_runstack_set_options(
+		gravm_runstack_t *self,
+		int options);
+
+/* marks 'node' as changed since the previous run. with GRAVM_RS_OPT_INCREMENTAL, the next run re-executes every edge
+ * whose target node is 'node' or can reach it; all other edges are not executed again, instead the child frame they
+ * produced during their last successful execution (which may have happened earlier in the same run) is handed to
+ * callback.ascend. this requires the child frame of an edge to depend on its subgraph only.
+ * changes of the program, gravm_runstack_set_edge_mask() and changes of the options discard all retained frames.
+ * changing the bits of the current edge mask in place is not noticed: mark the source nodes of the edges concerned
+ * dirty. -ENOENT: unknown node */
+int gravm_runstack_mark_dirty(
+		gravm_runstack_t *self,
+		int node);
+
+/* use 'cache' (which is not owned by the runstack) for memoizing subgraph results, see gravm/cache.h;
+ * NULL: disable caching. -EBUSY if called during execution */
+int gravm_runstack_set_cache(
+		gravm_runstack_t *self,
+		gravm_cache_t *cache);
+
+/* only descend into edges whose id is set in 'mask' (bit id % 64 of mask[id / 64]); the bitset must cover every
+ * edge id of the program and is not copied, so it must stay valid while running. disabled edges are skipped while
+ * iterating outgoing edges, i.e. they are never pushed; they are prepared and unprepared like any other edge unless
+ * GRAVM_RS_OPT_LAZY_PREPARE is set. a run whose root edges are all disabled succeeds without invoking any callback.
+ * edges added by gravm_runstack_emit() and edges executed below a call (see gravm_program_call()), even of the
+ * runstack's own program, are not affected. NULL: all edges enabled (default). discards the frames retained by
+ * GRAVM_RS_OPT_INCREMENTAL, see gravm_runstack_mark_dirty(), and keys cache entries by this call, see gravm/cache.h.
+ * -EBUSY if called during execution */
+int gravm_runstack_set_edge_mask(
+		gravm_runstack_t *self,
+		const uint64_t *mask);
+
+/* write a record for each instruction executed depth-first into 'trace' (which is not owned by the runstack), see
+ * gravm/trace.h; NULL: disable tracing. -ENOTSUP if the library has been built without GRAVM_TRACE, -EBUSY if called
+ * during execution */
+int gravm_runstack_set_trace(
+		gravm_runstack_t *self,
+		gravm_trace_t *trace);
+
+/* GRAVM_PROGRAM_* flags used when gravm_runstack_prepare() compiles the program; default: GRAVM_PROGRAM_DEFAULT */
+void gravm_runstack_set_program_flags(
+		gravm_runstack_t *self,
+		int flags);
+
+/* use an already compiled program instead of calling callback.init/structure.
+ * the program is not owned by the runstack and must outlive it */
+int gravm_runstack_prepare_program(
+		gravm_runstack_t *self,
+		gravm_program_t *program,
+		void *user);
+
+/* use the program currently published in 'slot'. the program stays pinned until the runstack is reset, prepared
+ * again or destroyed; gravm_runstack_reset() picks up the program published most recently */
+int gravm_runstack_prepare_slot(
+		gravm_runstack_t *self,
+		gravm_program_slot_t *slot,
+		void *user);
+
+/* program currently used by the runstack; NULL if not prepared */
+gravm_program_t *gravm_runstack_program(
+		gravm_runstack_t *self);
+
+/* stack size needed to execute the current program, see gravm_program_max_depth(); -EINVAL if not prepared.
+ * with GRAVM_RS_OPT_PREALLOCATE, that many frames (but not more than the maximum stack size) are allocated when
+ * preparing or at the latest when a run starts, so execution does not allocate frames. nothing is preallocated if the
+ * program contains a cycle (-ELOOP) */
+int gravm_runstack_max_depth(
+		gravm_runstack_t *self);
+
+/* discard the current execution (without invoking any callbacks) and return to the prepared state.
+ * if prepared using gravm_runstack_prepare_slot(), switches to the most recently published program */
+int gravm_runstack_reset(
+		gravm_runstack_t *self);
+
+/* add/remove a single edge without calling gravm_runstack_prepare() again. only possible if no execution is
+ * active and the program has been compiled by gravm_runstack_prepare() (-EPERM otherwise).
+ * the runstack is reset afterwards. 'id' must not be in use yet (-EEXIST). an edit is recorded in O(log n)
+ * (amortized) without moving any compiled edge; all edits made since the previous run are merged into the compiled
+ * edges once, in O(n + k log k) for k edits, when the next run starts. if callback.edge_payload fails, the edge is
+ * not added and its error is returned; the runstack is reset nevertheless */
+int gravm_runstack_edge_add(
+		gravm_runstack_t *self,
+		int id,
+		const gravm_runstack_edgedef_t *def);
+
+int gravm_runstack_edge_remove(
+		gravm_runstack_t *self,
+		int id);
+
+/* reorders the internal edge storage so that the edges of frequently visited nodes are stored next to each other.
+ * counts[id] is the number of times edge 'id' has been visited, e.g. counted in callback.edge_begin; ids >= n_counts
+ * are considered cold. traversal order is not affected. same restrictions as gravm_runstack_edge_add() */
+int gravm_runstack_relayout(
+		gravm_runstack_t *self,
+		const unsigned int *counts,
+		int n_counts);
+
+/* payload of the edge whose id has been passed to the callback currently being invoked; NULL if no payload is used */
+void *gravm_runstack_edge_payload(
+		gravm_runstack_t *self);
+
+/* payload of the node whose id has been passed to the node callback currently being invoked, or of the target node
+ * of the current edge in case of edge callbacks; NULL if no payload is used */
+void *gravm_runstack_node_payload(
+		gravm_runstack_t *self);
+
+/* only valid while callback.node_enter is invoked: adds a transient outgoing edge 'id' to 'target' (which must be a
+ * node of the program) for the current iteration of the node. emitted edges are executed like outgoing edges of the
+ * program, pre edges (priority < 0) before node_run and post edges after, in priority order and after the program's
+ * edges of the same kind. they are never prepared, unprepared or aborted, have no edge payload, are not subject to
+ * the edge mask (so 'id' may be any value) and are neither cached nor retained. the shared program is not modified. -EINVAL if not called from node_enter, -ENOENT for an
+ * unknown target, -ENOTSUP for GRAVM_RS_OPT_LEVEL_ORDER and GRAVM_RS_OPT_PRIORITY */
+int gravm_runstack_emit(
+		gravm_runstack_t *self,
+		int id,
+		int target,
+		int priority);
+
+/* call again after vm has been suspended.
+ * with GRAVM_RS_OPT_LEVEL_ORDER, all edges of depth d are executed before those of depth d + 1: for each level, every
+ * edge is descended into, begun and its target node entered, then all nodes of the level are run (see
+ * callback.node_run_batch) and the outgoing edges of each node which returned GRAVM_RS_TRUE are prepared and form the
+ * next level (pre- and post-edges alike). once the last level is done, the frames are completed in reverse order
+ * (edge_unprepare, node_leave, edge_end, ascend), so a frame is ascended from after all of its children.
+ * edge_next is not called, i.e. each edge runs exactly one iteration. there is no catch handling: a callback
+ * returning THROW ends the run after unwinding every frame not completed yet, children before their parents, as if
+ * no catch callback was set: its prepared outgoing edges are aborted (edge_abort/edges_abort) and, if it has been
+ * descended into, it is ascended from with 'throwing' set. the run can neither be suspended nor stepped
+ * (gravm_runstack_step() fails with -ENOTSUP), GRAVM_RS_OPT_INCREMENTAL and caches are not used. the maximum stack
+ * size limits the number of levels.
+ * GRAVM_RS_OPT_PRIORITY works the same way, except that instead of levels there is a single queue of ready edges,
+ * initially the root edges. the edge with the lowest priority value (ties: the one created first) is executed up to
+ * node_run, then the outgoing edges of its node are prepared and become ready. a frame is completed as soon as all of
+ * its children are completed, so node_enter/node_leave of a node still bracket those of all nodes below. a THROW
+ * unwinds the frames as in level order; frames completed before are left alone.
+ * callback.node_run_batch is not used. takes precedence over GRAVM_RS_OPT_LEVEL_ORDER */
 int gravm_runstack_run(
 		gravm_runstack_t *self);
 
+/* like gravm_runstack_run(), but starts with the 'n' edges given by 'edge_ids' (in this order) instead of the root
+ * edges. 'parent' is passed as parent context to the callbacks of these edges (descend, ascend) as if they were the
+ * outgoing edges of a node whose frame is 'parent'. the runstack must be prepared or reset; the start edges are kept
+ * when the run is suspended and resumed using gravm_runstack_run() or gravm_runstack_step() and forgotten by
+ * gravm_runstack_reset(). each id is found in O(log n); the program's id index is built on first use. fails with
+ * -ENOENT for unknown edge ids and -ENOTSUP for GRAVM_RS_OPT_LEVEL_ORDER and GRAVM_RS_OPT_PRIORITY */
+int gravm_runstack_run_from(
+		gravm_runstack_t *self,
+		const int *edge_ids,
+		int n,
+		void *parent);
+
+/* executes 'program' once for each of the 'n' user contexts in 'users', interleaved on the calling thread: the
+ * executions (lanes) are advanced in turn, one callback at a time, so stalls of one lane's callbacks overlap with the
+ * work of the others. if callback.node_run_lanes is set, a lane reaching node_run waits until every other running
+ * lane has reached node_run as well; then all of them are run by a single node_run_lanes call. lanes in lockstep
+ * (e.g. the same program on similar inputs) thus run each node together. the lanes use the callbacks, frame size,
+ * maximum stack size, options, cache, edge mask and trace of 'self', which is neither prepared nor otherwise affected; callback.destroy is not called for the user contexts.
+ * the lane runstacks are kept for the next batch. results[i] receives GRAVM_RS_SUCCESS, GRAVM_RS_THROW (uncaught
+ * exception) or GRAVM_RS_FATAL for users[i]. returns GRAVM_RS_FATAL if the batch could not be started, otherwise
+ * GRAVM_RS_SUCCESS. lanes cannot be suspended; -ENOTSUP for GRAVM_RS_OPT_LEVEL_ORDER and GRAVM_RS_OPT_PRIORITY */
+int gravm_runstack_run_batch(
+		gravm_runstack_t *self,
+		gravm_program_t *program,
+		void *const *users,
+		int n,
+		int *results);
+
 int gravm_runstack_suspend(
 		gravm_runstack_t *self);
 
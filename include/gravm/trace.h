@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+
+#include <gravm/runstack.h>
+
+/* live monitoring of a running runstack. a trace is a lock-free single-producer/single-consumer ring: the runstack
+ * it has been attached to (see gravm_runstack_set_trace()) writes one record per executed instruction, including
+ * those of its batch lanes (which run on the same thread), any other thread may drain it concurrently using
+ * gravm_trace_read(). the producer never waits; records are dropped while the ring is full. recording is only compiled in if the library has been built with GRAVM_TRACE */
+
+typedef struct gravm_trace gravm_trace_t;
+
+typedef struct {
+	uint64_t time; /* CLOCK_MONOTONIC, in nanoseconds */
+	int32_t lane; /* index of the lane executing the instruction, see gravm_runstack_run_batch(); -1: no batch */
+	int32_t edge; /* id of the current edge */
+	int32_t node; /* target node of the current edge */
+	int16_t ip; /* GRAVM_RS_IP_* about to be executed */
+	int16_t state; /* GRAVM_RS_STATE_EXECUTING or GRAVM_RS_STATE_THROWING */
+} gravm_trace_record_t;
+
+/* 'capacity' is rounded up to a power of two. sets errno in case NULL is returned */
+gravm_trace_t *gravm_trace_new(
+		int capacity);
+
+/* must not be attached to a runstack anymore */
+void gravm_trace_destroy(
+		gravm_trace_t *self);
+
+/* consumer side: moves up to 'n' of the oldest records into 'records' and returns their number; -EINVAL if 'n' is
+ * negative */
+int gravm_trace_read(
+		gravm_trace_t *self,
+		gravm_trace_record_t *records,
+		int n);
+
+/* number of records dropped so far because the ring was full */
+uint64_t gravm_trace_dropped(
+		gravm_trace_t *self);
@@ -0,0 +1,283 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "cache_private.h"
+
+#include <gravm/cache.h>
+
+#define CACHE_MIN_BUCKETS 64
+
+typedef struct cache_entry cache_entry_t;
+
+struct cache_entry {
+	uint64_t program;
+	uint64_t mask;
+	uint64_t fingerprint;
+	int id;
+	bool referenced; /* CLOCK: has been hit since the hand passed last time */
+	size_t size;
+	cache_entry_t *hnext; /* hash chain */
+	cache_entry_t *cprev; /* CLOCK ring */
+	cache_entry_t *cnext;
+	char data[];
+};
+
+struct gravm_cache {
+	pthread_mutex_t lock;
+	size_t max_bytes;
+	size_t bytes;
+
+	cache_entry_t **buckets;
+	size_t n_buckets; /* power of two */
+	size_t n_entries;
+
+	cache_entry_t *hand; /* next entry to be considered for eviction; NULL if empty */
+
+	unsigned long hits;
+	unsigned long misses;
+};
+
+static size_t entry_bytes(
+		size_t size)
+{
+	return sizeof(cache_entry_t) + size;
+}
+
+static size_t hash(
+		uint64_t program,
+		uint64_t mask,
+		int id,
+		uint64_t fingerprint)
+{
+	uint64_t h = fingerprint ^ ((uint64_t)(unsigned int)id * 0x9e3779b97f4a7c15ULL) ^ (program * 0xc2b2ae3d27d4eb4fULL) ^
+		(mask * 0x165667b19e3779f9ULL);
+	h ^= h >> 33;
+	h *= 0xff51afd7ed558ccdULL;
+	h ^= h >> 33;
+	return (size_t)h;
+}
+
+static cache_entry_t **find(
+		gravm_cache_t *self,
+		uint64_t program,
+		uint64_t mask,
+		int id,
+		uint64_t fingerprint)
+{
+	cache_entry_t **cur = self->buckets + (hash(program, mask, id, fingerprint) & (self->n_buckets - 1));
+
+	while(*cur != NULL && ((*cur)->id != id || (*cur)->fingerprint != fingerprint || (*cur)->program != program ||
+			(*cur)->mask != mask))
+		cur = &(*cur)->hnext;
+	return cur;
+}
+
+/* removes the entry from its hash chain and the CLOCK ring and frees it */
+static void evict(
+		gravm_cache_t *self,
+		cache_entry_t *entry)
+{
+	cache_entry_t **link = find(self, entry->program, entry->mask, entry->id, entry->fingerprint);
+
+	assert(*link == entry);
+	*link = entry->hnext;
+	if(entry->cnext == entry)
+		self->hand = NULL;
+	else {
+		entry->cprev->cnext = entry->cnext;
+		entry->cnext->cprev = entry->cprev;
+		if(self->hand == entry)
+			self->hand = entry->cnext;
+	}
+	self->bytes -= entry_bytes(entry->size);
+	self->n_entries--;
+	free(entry);
+}
+
+/* CLOCK: referenced entries get a second chance, the first unreferenced one is evicted */
+static void evict_one(
+		gravm_cache_t *self)
+{
+	while(self->hand->referenced) {
+		self->hand->referenced = false;
+		self->hand = self->hand->cnext;
+	}
+	evict(self, self->hand);
+}
+
+static void rehash(
+		gravm_cache_t *self)
+{
+	cache_entry_t **buckets;
+	cache_entry_t *cur;
+	cache_entry_t *next;
+	size_t n_buckets = self->n_buckets * 2;
+	size_t i;
+	size_t b;
+
+	buckets = calloc(n_buckets, sizeof(cache_entry_t*));
+	if(buckets == NULL) /* just keep the longer chains */
+		return;
+	for(i = 0; i < self->n_buckets; i++)
+		for(cur = self->buckets[i]; cur != NULL; cur = next) {
+			next = cur->hnext;
+			b = hash(cur->program, cur->mask, cur->id, cur->fingerprint) & (n_buckets - 1);
+			cur->hnext = buckets[b];
+			buckets[b] = cur;
+		}
+	free(self->buckets);
+	self->buckets = buckets;
+	self->n_buckets = n_buckets;
+}
+
+gravm_cache_t *gravm_cache_new(
+		size_t max_bytes)
+{
+	gravm_cache_t *cache;
+
+	cache = calloc(1, sizeof(*cache));
+	if(cache == NULL) {
+		errno = -ENOMEM;
+		return NULL;
+	}
+	cache->buckets = calloc(CACHE_MIN_BUCKETS, sizeof(cache_entry_t*));
+	if(cache->buckets == NULL) {
+		free(cache);
+		errno = -ENOMEM;
+		return NULL;
+	}
+	cache->n_buckets = CACHE_MIN_BUCKETS;
+	cache->max_bytes = max_bytes;
+	pthread_mutex_init(&cache->lock, NULL);
+	return cache;
+}
+
+void gravm_cache_destroy(
+		gravm_cache_t *self)
+{
+	gravm_cache_clear(self);
+	pthread_mutex_destroy(&self->lock);
+	free(self->buckets);
+	free(self);
+}
+
+void gravm_cache_clear(
+		gravm_cache_t *self)
+{
+	pthread_mutex_lock(&self->lock);
+	while(self->hand != NULL)
+		evict(self, self->hand);
+	pthread_mutex_unlock(&self->lock);
+}
+
+size_t gravm_cache_bytes(
+		gravm_cache_t *self)
+{
+	size_t bytes;
+
+	pthread_mutex_lock(&self->lock);
+	bytes = self->bytes;
+	pthread_mutex_unlock(&self->lock);
+	return bytes;
+}
+
+void gravm_cache_stats(
+		gravm_cache_t *self,
+		unsigned long *hits,
+		unsigned long *misses)
+{
+	pthread_mutex_lock(&self->lock);
+	*hits = self->hits;
+	*misses = self->misses;
+	pthread_mutex_unlock(&self->lock);
+}
+
+bool cache_lookup(
+		gravm_cache_t *self,
+		uint64_t program,
+		uint64_t mask,
+		int id,
+		uint64_t fingerprint,
+		void *data,
+		size_t size)
+{
+	cache_entry_t *entry;
+	bool found = false;
+
+	pthread_mutex_lock(&self->lock);
+	entry = *find(self, program, mask, id, fingerprint);
+	if(entry != NULL && entry->size == size) {
+		memcpy(data, entry->data, size);
+		entry->referenced = true;
+		found = true;
+		self->hits++;
+	}
+	else
+		self->misses++;
+	pthread_mutex_unlock(&self->lock);
+	return found;
+}
+
+int cache_store(
+		gravm_cache_t *self,
+		uint64_t program,
+		uint64_t mask,
+		int id,
+		uint64_t fingerprint,
+		const void *data,
+		size_t size)
+{
+	cache_entry_t **link;
+	cache_entry_t *entry;
+
+	if(entry_bytes(size) > self->max_bytes)
+		return -E2BIG;
+	entry = malloc(entry_bytes(size));
+	if(entry == NULL)
+		return -ENOMEM;
+	entry->program = program;
+	entry->mask = mask;
+	entry->id = id;
+	entry->fingerprint = fingerprint;
+	entry->referenced = false;
+	entry->size = size;
+	memcpy(entry->data, data, size);
+
+	pthread_mutex_lock(&self->lock);
+	link = find(self, program, mask, id, fingerprint);
+	if(*link != NULL)
+		evict(self, *link);
+	while(self->bytes + entry_bytes(size) > self->max_bytes)
+		evict_one(self);
+
+	/* insert right behind the hand, i.e. the new entry is considered last */
+	if(self->hand == NULL) {
+		entry->cprev = entry->cnext = entry;
+		self->hand = entry;
+	}
+	else {
+		entry->cnext = self->hand;
+		entry->cprev = self->hand->cprev;
+		entry->cprev->cnext = entry;
+		self->hand->cprev = entry;
+	}
+	link = find(self, program, mask, id, fingerprint);
+	entry->hnext = NULL;
+	*link = entry;
+	self->bytes += entry_bytes(size);
+	self->n_entries++;
+	if(self->n_entries > self->n_buckets)
+		rehash(self);
+	pthread_mutex_unlock(&self->lock);
+	return 0;
+}
+
+#ifdef TESTING
+#include "../test/cache.h"
+#endif
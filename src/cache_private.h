@@ -0,0 +1,30 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <gravm/cache.h>
+
+/* copies the entry stored for (program, mask, id, fingerprint) into 'data'; entries of a different size never match.
+ * 'program' is the identity of the program the edge 'id' belongs to, 'mask' identifies the edge mask in effect
+ * (0: none) */
+bool cache_lookup(
+		gravm_cache_t *self,
+		uint64_t program,
+		uint64_t mask,
+		int id,
+		uint64_t fingerprint,
+		void *data,
+		size_t size);
+
+/* inserts or replaces the entry for (program, mask, id, fingerprint), evicting other entries if necessary.
+ * -E2BIG if the entry alone exceeds the budget */
+int cache_store(
+		gravm_cache_t *self,
+		uint64_t program,
+		uint64_t mask,
+		int id,
+		uint64_t fingerprint,
+		const void *data,
+		size_t size);
@@ -1,4 +1,2 @@
 #pragma once
 
-#define GRAVM_BTREE_ORDER 31
-
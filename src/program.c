@@ -0,0 +1,1795 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <limits.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+#include "config.h"
+#include "program_private.h"
+
+#include <gravm/program.h>
+
+#define PAGING_CHUNK (64 * 1024) /* unit of residency tracking; at least one page */
+#define PAGING_PREFETCH 8 /* number of children whose outgoing edges are prefetched */
+
+typedef struct retired retired_t;
+
+struct retired {
+	gravm_program_t *program;
+	uint64_t epoch; /* epoch during which the program has been replaced */
+	retired_t *next;
+};
+
+/* residency of the mapping in chunks of 'chunk' bytes. resident chunks form a LRU list, most recently used first */
+struct program_paging {
+	pthread_mutex_t lock; /* the program may be executed by several runstacks at once */
+	size_t max_bytes;
+	size_t chunk;
+	int n_chunks;
+	int *prev; /* per chunk; -1: none */
+	int *next;
+	char *resident;
+	int head; /* -1: no resident chunks */
+	int tail;
+	int n_resident;
+};
+
+static _Atomic uint64_t next_identity = 1;
+
+struct gravm_program_slot {
+	_Atomic(gravm_program_t*) current;
+	_Atomic uint64_t epoch;
+
+	pthread_mutex_t lock; /* protects readers and retired; never taken during execution */
+	slot_reader_t *readers;
+	retired_t *retired;
+};
+
+static int cmp_full(
+		const void *a_,
+		const void *b_)
+{
+	const edge_entry_t *a = a_;
+	const edge_entry_t *b = b_;
+	if(a->source < b->source)
+		return -1;
+	else if(a->source > b->source)
+		return 1;
+	else if(a->priority < b->priority)
+		return -1;
+	else if(a->priority > b->priority)
+		return 1;
+	else if(a->target < b->target)
+		return -1;
+	else if(a->target > b->target)
+		return 1;
+	else if(a->id < b->id)
+		return -1;
+	else if(a->id > b->id)
+		return 1;
+	else
+		return 0;
+}
+
+/* calls callback.node_payload for the nodes [lower, upper) */
+static int fill_node_payloads(
+		gravm_program_t *self,
+		const gravm_runstack_callback_t *cb,
+		void *user,
+		int lower,
+		int upper)
+{
+	int x;
+	int ret;
+
+	if(self->node_payload_size == 0 || cb->node_payload == NULL)
+		return 0;
+	for(x = lower; x < upper; x++) {
+		ret = cb->node_payload(user, x, program_node_payload(program_node(self, x)));
+		if(ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/* makes sure 'node' is covered by the node range table */
+static int grow_nodes(
+		gravm_program_t *self,
+		int node,
+		const gravm_runstack_callback_t *cb,
+		void *user)
+{
+	range_t *range;
+	char *nodes;
+	int capacity;
+	int old_n_nodes = self->n_nodes;
+	int i;
+
+	if(node + 1 < self->n_nodes)
+		return 0;
+	if(node + 1 >= self->nodes_capacity) {
+		capacity = self->nodes_capacity < 8 ? 16 : self->nodes_capacity;
+		while(capacity <= node + 1)
+			capacity *= 2;
+		nodes = realloc(self->nodes, self->node_stride * capacity);
+		if(nodes == NULL)
+			return -ENOMEM;
+		self->nodes = nodes;
+		self->nodes_capacity = capacity;
+	}
+	memset(self->nodes + self->node_stride * self->n_nodes, 0, self->node_stride * (node + 2 - self->n_nodes));
+	for(i = self->n_nodes; i <= node + 1; i++) {
+		range = program_node(self, i - 1);
+		range->lower = self->n_edges;
+		range->boundary = self->n_edges;
+		range->upper = self->n_edges;
+	}
+	self->n_nodes = node + 2;
+	return fill_node_payloads(self, cb, user, old_n_nodes - 1, node + 1);
+}
+
+static int cmp_id(
+		const void *a_,
+		const void *b_)
+{
+	const id_entry_t *a = a_;
+	const id_entry_t *b = b_;
+	if(a->id < b->id)
+		return -1;
+	else if(a->id > b->id)
+		return 1;
+	else
+		return 0;
+}
+
+/* first of the first 'n' entries of the id index whose id is not less than 'id' */
+static int ids_lower_bound(
+		const gravm_program_t *self,
+		int n,
+		int id)
+{
+	int lower = 0;
+	int upper = n;
+	int mid;
+
+	while(lower < upper) {
+		mid = lower + (upper - lower) / 2;
+		if(self->ids[mid].id < id)
+			lower = mid + 1;
+		else
+			upper = mid;
+	}
+	return lower;
+}
+
+/* self->lock must be held */
+static int build_ids(
+		gravm_program_t *self)
+{
+	int i;
+
+	self->ids = malloc(sizeof(id_entry_t) * self->n_edges);
+	if(self->ids == NULL)
+		return -ENOMEM;
+	for(i = 0; i < self->n_edges; i++) {
+		self->ids[i].id = program_edge(self, i)->id;
+		self->ids[i].index = i;
+	}
+	qsort(self->ids, self->n_edges, sizeof(id_entry_t), cmp_id);
+	return 0;
+}
+
+/* the edge array changed as a whole; the id index is rebuilt on its next use */
+static void drop_ids(
+		gravm_program_t *self)
+{
+	free(self->ids);
+	self->ids = NULL;
+}
+
+/* rearranges the node blocks of the edge array so that they appear in the given order of node table indices.
+ * edges keep their order within a block and their ids */
+static int place_blocks(
+		gravm_program_t *self,
+		const int *order)
+{
+	char *edges;
+	range_t *range;
+	int lower;
+	int pos = 0;
+	int i;
+
+	edges = malloc(self->edge_stride * (self->n_edges > 0 ? self->n_edges : 1));
+	if(edges == NULL)
+		return -ENOMEM;
+	for(i = 0; i < self->n_nodes; i++) {
+		range = program_node(self, order[i] - 1);
+		lower = range->lower;
+		memcpy(edges + self->edge_stride * pos, program_edge(self, lower), self->edge_stride * (range->upper - lower));
+		range->lower = pos;
+		range->boundary += pos - lower;
+		range->upper += pos - lower;
+		pos = range->upper;
+	}
+	free(self->edges);
+	self->edges = edges;
+	drop_ids(self);
+	return 0;
+}
+
+/* orders the node blocks by first visit of a depth-first traversal from the root, i.e. the order in which
+ * a runstack needs them. blocks of unreachable nodes are appended in ascending node order */
+static int layout_dfs(
+		gravm_program_t *self)
+{
+	struct {
+		int index;
+		int upper;
+	} *stack;
+	bool *placed;
+	int *order;
+	int n_order = 0;
+	int depth = 0;
+	int target;
+	int i;
+	int ret = -ENOMEM;
+
+	order = malloc(sizeof(int) * self->n_nodes);
+	placed = calloc(self->n_nodes, sizeof(bool));
+	stack = malloc(sizeof(*stack) * self->n_nodes);
+	if(order == NULL || placed == NULL || stack == NULL)
+		goto out;
+
+	order[n_order++] = 0;
+	placed[0] = true;
+	stack[depth].index = program_node(self, GRAVM_RS_ROOT)->lower;
+	stack[depth].upper = program_node(self, GRAVM_RS_ROOT)->upper;
+	depth++;
+	while(depth > 0) {
+		if(stack[depth - 1].index == stack[depth - 1].upper) {
+			depth--;
+			continue;
+		}
+		target = program_edge(self, stack[depth - 1].index++)->target + 1;
+		if(placed[target])
+			continue;
+		placed[target] = true;
+		order[n_order++] = target;
+		stack[depth].index = program_node(self, target - 1)->lower;
+		stack[depth].upper = program_node(self, target - 1)->upper;
+		depth++;
+	}
+	for(i = 0; i < self->n_nodes; i++)
+		if(!placed[i])
+			order[n_order++] = i;
+
+	ret = place_blocks(self, order);
+out:
+	free(stack);
+	free(placed);
+	free(order);
+	return ret;
+}
+
+/* longest chain of edges starting at the root, i.e. the number of frames a depth-first run needs at most.
+ * -ELOOP if a cycle is reachable from the root */
+static int compute_depth(
+		const gravm_program_t *self)
+{
+	struct {
+		int node; /* node table index */
+		int index;
+		int upper;
+		int depth; /* deepest chain below the node found so far */
+	} *stack;
+	int *depth; /* per node table entry; DEPTH_UNVISITED, DEPTH_ACTIVE (on the stack) or the final depth */
+	int n_stack = 0;
+	int target;
+	int i;
+	int ret = -ENOMEM;
+
+	enum {
+		DEPTH_UNVISITED = -1,
+		DEPTH_ACTIVE = -2
+	};
+
+	depth = malloc(sizeof(int) * self->n_nodes);
+	stack = malloc(sizeof(*stack) * self->n_nodes);
+	if(depth == NULL || stack == NULL)
+		goto out;
+	for(i = 0; i < self->n_nodes; i++)
+		depth[i] = DEPTH_UNVISITED;
+
+	depth[0] = DEPTH_ACTIVE;
+	stack[n_stack].node = 0;
+	stack[n_stack].index = program_node(self, GRAVM_RS_ROOT)->lower;
+	stack[n_stack].upper = program_node(self, GRAVM_RS_ROOT)->upper;
+	stack[n_stack].depth = 0;
+	n_stack++;
+	while(n_stack > 0) {
+		if(stack[n_stack - 1].index == stack[n_stack - 1].upper) {
+			n_stack--;
+			depth[stack[n_stack].node] = stack[n_stack].depth;
+			if(n_stack > 0 && stack[n_stack].depth + 1 > stack[n_stack - 1].depth)
+				stack[n_stack - 1].depth = stack[n_stack].depth + 1;
+			continue;
+		}
+		target = program_edge(self, stack[n_stack - 1].index++)->target + 1;
+		if(depth[target] == DEPTH_ACTIVE) {
+			ret = -ELOOP;
+			goto out;
+		}
+		else if(depth[target] != DEPTH_UNVISITED) {
+			if(depth[target] + 1 > stack[n_stack - 1].depth)
+				stack[n_stack - 1].depth = depth[target] + 1;
+			continue;
+		}
+		depth[target] = DEPTH_ACTIVE;
+		stack[n_stack].node = target;
+		stack[n_stack].index = program_node(self, target - 1)->lower;
+		stack[n_stack].upper = program_node(self, target - 1)->upper;
+		stack[n_stack].depth = 0;
+		n_stack++;
+	}
+	ret = depth[0];
+out:
+	free(stack);
+	free(depth);
+	return ret;
+}
+
+typedef struct {
+	unsigned long long weight;
+	int node;
+} weighted_node_t;
+
+static int cmp_weight(
+		const void *a_,
+		const void *b_)
+{
+	const weighted_node_t *a = a_;
+	const weighted_node_t *b = b_;
+	if(a->weight > b->weight)
+		return -1;
+	else if(a->weight < b->weight)
+		return 1;
+	else if(a->node < b->node)
+		return -1;
+	else if(a->node > b->node)
+		return 1;
+	else
+		return 0;
+}
+
+typedef struct compiler compiler_t;
+
+/* state shared by all shards of a compilation */
+struct compiler {
+	const gravm_runstack_callback_t *cb;
+	void *user;
+	int nshards;
+	gravm_program_t *program; /* program being compiled */
+	char *tmp; /* merge buffer */
+	int width; /* current merge width in number of shards */
+	int *shard_lower; /* nshards + 1 entries */
+	int err[GRAVM_PROGRAM_MAX_THREADS];
+};
+
+typedef struct {
+	compiler_t *compiler;
+	int shard;
+	void (*fn)(compiler_t*, int);
+} shard_t;
+
+static void *shard_main(
+		void *arg)
+{
+	shard_t *shard = arg;
+	shard->fn(shard->compiler, shard->shard);
+	return NULL;
+}
+
+/* runs fn for every shard; shard 0 runs in the calling thread */
+static int for_each_shard(
+		compiler_t *self,
+		int nshards,
+		void (*fn)(compiler_t*, int))
+{
+	pthread_t threads[GRAVM_PROGRAM_MAX_THREADS];
+	shard_t shards[GRAVM_PROGRAM_MAX_THREADS];
+	int started;
+	int ret = 0;
+	int i;
+
+	for(started = 1; started < nshards; started++) {
+		shards[started].compiler = self;
+		shards[started].shard = started;
+		shards[started].fn = fn;
+		if(pthread_create(threads + started, NULL, shard_main, shards + started) != 0) {
+			ret = -EAGAIN;
+			break;
+		}
+	}
+	if(ret == 0)
+		fn(self, 0);
+	for(i = 1; i < started; i++)
+		pthread_join(threads[i], NULL);
+	return ret;
+}
+
+static int read_edge(
+		compiler_t *self,
+		int i)
+{
+	gravm_runstack_edgedef_t def;
+	edge_entry_t *entry = program_edge(self->program, i);
+	int ret;
+
+	memset(&def, 0, sizeof(def));
+	ret = self->cb->structure(self->user, i, &def);
+	if(ret < 0)
+		return ret;
+	if(def.target == GRAVM_RS_ROOT)
+		return -EINVAL;
+	else if(def.target < 0 || def.source < GRAVM_RS_ROOT)
+		return -EINVAL;
+	memset(entry, 0, self->program->edge_stride);
+	entry->id = i;
+	entry->source = def.source;
+	entry->priority = def.priority;
+	entry->target = def.target;
+	if(self->program->edge_payload_size > 0 && self->cb->edge_payload != NULL)
+		return self->cb->edge_payload(self->user, i, program_edge_payload(entry));
+	return 0;
+}
+
+static void shard_sort(
+		compiler_t *self,
+		int shard)
+{
+	int lower = self->shard_lower[shard];
+	int upper = self->shard_lower[shard + 1];
+	qsort(program_edge(self->program, lower), upper - lower, self->program->edge_stride, cmp_full);
+}
+
+static void shard_structure(
+		compiler_t *self,
+		int shard)
+{
+	int i;
+	int ret;
+
+	for(i = self->shard_lower[shard]; i < self->shard_lower[shard + 1]; i++) {
+		ret = read_edge(self, i);
+		if(ret < 0) {
+			self->err[shard] = ret;
+			return;
+		}
+	}
+	shard_sort(self, shard);
+}
+
+/* merges the sorted runs [shard, shard + width) and [shard + width, shard + 2 * width) into tmp */
+static void shard_merge(
+		compiler_t *self,
+		int pair)
+{
+	const size_t stride = self->program->edge_stride;
+	int shard = pair * 2 * self->width;
+	int a;
+	int a_upper;
+	int b;
+	int b_upper;
+	int out;
+
+	if(shard >= self->nshards)
+		return;
+	a = out = self->shard_lower[shard];
+	a_upper = b = self->shard_lower[shard + self->width < self->nshards ? shard + self->width : self->nshards];
+	b_upper = self->shard_lower[shard + 2 * self->width < self->nshards ? shard + 2 * self->width : self->nshards];
+
+	while(a < a_upper && b < b_upper) {
+		if(cmp_full(program_edge(self->program, b), program_edge(self->program, a)) < 0)
+			memcpy(self->tmp + stride * out++, program_edge(self->program, b++), stride);
+		else
+			memcpy(self->tmp + stride * out++, program_edge(self->program, a++), stride);
+	}
+	memcpy(self->tmp + stride * out, program_edge(self->program, a), stride * (a_upper - a));
+	out += a_upper - a;
+	memcpy(self->tmp + stride * out, program_edge(self->program, b), stride * (b_upper - b));
+}
+
+/* range derivation: the element at which a new source group begins is the lower bound
+ * for all nodes between the previous source and its own; every node is written by exactly one shard */
+static void shard_bounds(
+		compiler_t *self,
+		int shard)
+{
+	const gravm_program_t *program = self->program;
+	const edge_entry_t *cur;
+	const edge_entry_t *last = NULL;
+	int i;
+	int prev;
+	int x;
+
+	for(i = self->shard_lower[shard]; i < self->shard_lower[shard + 1]; i++) {
+		cur = program_edge(program, i);
+		if(i > 0)
+			last = program_edge(program, i - 1);
+		prev = last == NULL ? GRAVM_RS_ROOT - 1 : last->source;
+		if(cur->source != prev)
+			for(x = prev + 1; x <= cur->source; x++)
+				program_node(program, x)->lower = i;
+		if(cur->priority >= 0 && (cur->source != prev || last->priority < 0))
+			program_node(program, cur->source)->boundary = i;
+	}
+}
+
+static void split(
+		compiler_t *self,
+		int n)
+{
+	int i;
+	for(i = 0; i <= self->nshards; i++)
+		self->shard_lower[i] = (int)((long long)n * i / self->nshards);
+}
+
+static int shard_count(
+		int n,
+		int flags)
+{
+	long cpus;
+	int nshards;
+
+	if((flags & GRAVM_PROGRAM_PARALLEL) == 0)
+		return 1;
+	cpus = sysconf(_SC_NPROCESSORS_ONLN);
+	nshards = n / GRAVM_PROGRAM_MIN_SHARD;
+	if(nshards > cpus)
+		nshards = cpus;
+	if(nshards > GRAVM_PROGRAM_MAX_THREADS)
+		nshards = GRAVM_PROGRAM_MAX_THREADS;
+	if(nshards < 1)
+		nshards = 1;
+	return nshards;
+}
+
+/* collects all edges, sorts them according to cmp_full and derives the node range table
+ * in a linear scan. with GRAVM_PROGRAM_PARALLEL, each step is split into shards */
+static int compile(
+		gravm_program_t *self,
+		const gravm_runstack_callback_t *cb,
+		void *user,
+		int flags)
+{
+	compiler_t c;
+	int shard_lower[GRAVM_PROGRAM_MAX_THREADS + 1];
+	range_t *range;
+	char *swap;
+	int max_node;
+	int n;
+	int i;
+	int x;
+	int ret;
+
+	memset(&c, 0, sizeof(c));
+	c.cb = cb;
+	c.user = user;
+	c.shard_lower = shard_lower;
+	c.program = self;
+	n = cb->init(user);
+	if(n < 0)
+		return n;
+	else if(n == 0) /* missing root edges */
+		return -ENOENT;
+
+	self->edges = malloc(self->edge_stride * n);
+	if(self->edges == NULL)
+		return -ENOMEM;
+	self->n_edges = n;
+	c.nshards = shard_count(n, flags);
+	split(&c, n);
+
+	/* read and sort */
+	if((flags & GRAVM_PROGRAM_STRUCTURE_THREADSAFE) != 0) {
+		ret = for_each_shard(&c, c.nshards, shard_structure);
+		if(ret < 0)
+			goto error;
+	}
+	else {
+		for(i = 0; i < n; i++) {
+			ret = read_edge(&c, i);
+			if(ret < 0)
+				goto error;
+		}
+		ret = for_each_shard(&c, c.nshards, shard_sort);
+		if(ret < 0)
+			goto error;
+	}
+	for(i = 0; i < c.nshards; i++)
+		if(c.err[i] < 0) {
+			ret = c.err[i];
+			goto error;
+		}
+	if(c.nshards > 1) {
+		c.tmp = malloc(self->edge_stride * n);
+		if(c.tmp == NULL) {
+			ret = -ENOMEM;
+			goto error;
+		}
+		for(c.width = 1; c.width < c.nshards; c.width *= 2) {
+			ret = for_each_shard(&c, (c.nshards + 2 * c.width - 1) / (2 * c.width), shard_merge);
+			if(ret < 0)
+				goto error;
+			swap = self->edges;
+			self->edges = c.tmp;
+			c.tmp = swap;
+		}
+		free(c.tmp);
+		c.tmp = NULL;
+	}
+
+	if(program_edge(self, 0)->source != GRAVM_RS_ROOT) { /* missing root edges */
+		ret = -ENOENT;
+		goto error;
+	}
+
+	/* ranges */
+	max_node = GRAVM_RS_ROOT;
+	for(i = 0; i < n; i++)
+		if(program_edge(self, i)->target > max_node)
+			max_node = program_edge(self, i)->target;
+	if(program_edge(self, n - 1)->source > max_node)
+		max_node = program_edge(self, n - 1)->source;
+	self->nodes = calloc(max_node + 2, self->node_stride);
+	if(self->nodes == NULL) {
+		ret = -ENOMEM;
+		goto error;
+	}
+	self->n_nodes = max_node + 2;
+	self->nodes_capacity = max_node + 2;
+	for(x = GRAVM_RS_ROOT; x <= max_node; x++) {
+		program_node(self, x)->lower = n;
+		program_node(self, x)->boundary = -1;
+	}
+	ret = for_each_shard(&c, c.nshards, shard_bounds);
+	if(ret < 0)
+		goto error;
+	for(x = GRAVM_RS_ROOT; x <= max_node; x++) {
+		range = program_node(self, x);
+		range->upper = x == max_node ? n : program_node(self, x + 1)->lower;
+		if(range->boundary < 0)
+			range->boundary = range->upper;
+	}
+	ret = fill_node_payloads(self, cb, user, 0, max_node + 1);
+	if(ret < 0)
+		goto error;
+	return 0;
+
+error:
+	free(self->nodes);
+	free(c.tmp);
+	free(self->edges);
+	self->nodes = NULL;
+	self->edges = NULL;
+	return ret;
+}
+
+static int write_all(
+		int fd,
+		const void *data,
+		size_t size)
+{
+	const char *cur = data;
+	ssize_t ret;
+
+	while(size > 0) {
+		ret = write(fd, cur, size);
+		if(ret < 0 && errno == EINTR)
+			continue;
+		else if(ret < 0)
+			return -errno;
+		cur += ret;
+		size -= ret;
+	}
+	return 0;
+}
+
+static int check_header(
+		const program_header_t *header,
+		size_t size)
+{
+	if(size < sizeof(program_header_t))
+		return -EINVAL;
+	else if(memcmp(header->magic, GRAVM_PROGRAM_MAGIC, sizeof(header->magic)) != 0)
+		return -EINVAL;
+	else if(header->endian != GRAVM_PROGRAM_ENDIAN) /* written on a machine with different byte order */
+		return -ENOEXEC;
+	else if(header->version != GRAVM_PROGRAM_VERSION)
+		return -ENOEXEC;
+	else if(header->header_size != sizeof(program_header_t) || header->edge_size != sizeof(edge_entry_t) || header->node_size != sizeof(range_t))
+		return -ENOEXEC;
+	else if(header->edge_payload_size > INT_MAX || header->node_payload_size > INT_MAX)
+		return -EINVAL;
+	else if(header->size != size)
+		return -EINVAL;
+	else if(header->n_edges <= 0)
+		return -EINVAL;
+	else if(header->edges_offset % PAYLOAD_ALIGN != 0 || header->edges_offset + (uint64_t)header->n_edges * program_stride(sizeof(edge_entry_t), header->edge_payload_size) > size)
+		return -EINVAL;
+	else if(header->n_nodes <= 0)
+		return -EINVAL;
+	else if(header->nodes_offset % PAYLOAD_ALIGN != 0 || header->nodes_offset + (uint64_t)header->n_nodes * program_stride(sizeof(range_t), header->node_payload_size) > size)
+		return -EINVAL;
+	else
+		return 0;
+}
+
+gravm_program_t *gravm_program_new(
+		const gravm_runstack_callback_t *cb,
+		void *user,
+		int flags)
+{
+	return gravm_program_new_payload(cb, user, flags, 0, 0);
+}
+
+gravm_program_t *gravm_program_new_payload(
+		const gravm_runstack_callback_t *cb,
+		void *user,
+		int flags,
+		int edge_payload_size,
+		int node_payload_size)
+{
+	gravm_program_t *program;
+	int ret;
+
+	assert(cb->init != NULL);
+	assert(cb->structure != NULL);
+
+	if(edge_payload_size < 0 || node_payload_size < 0) {
+		errno = -EINVAL;
+		return NULL;
+	}
+	program = calloc(1, sizeof(*program));
+	if(program == NULL) {
+		errno = -ENOMEM;
+		return NULL;
+	}
+	program->storage = PROGRAM_HEAP;
+	program->fd = -1;
+	program->identity = atomic_fetch_add(&next_identity, 1);
+	pthread_mutex_init(&program->lock, NULL);
+	program->edge_payload_size = edge_payload_size;
+	program->edge_stride = program_stride(sizeof(edge_entry_t), edge_payload_size);
+	program->node_payload_size = node_payload_size;
+	program->node_stride = program_stride(sizeof(range_t), node_payload_size);
+
+	ret = compile(program, cb, user, flags);
+	if(ret < 0) {
+		pthread_mutex_destroy(&program->lock);
+		free(program);
+		errno = ret;
+		return NULL;
+	}
+	if((flags & GRAVM_PROGRAM_LAYOUT_DFS) != 0) {
+		ret = layout_dfs(program);
+		if(ret < 0) {
+			gravm_program_destroy(program);
+			errno = ret;
+			return NULL;
+		}
+	}
+	program->size = program->n_edges;
+	program->root_edges = program_node(program, GRAVM_RS_ROOT)->upper - program_node(program, GRAVM_RS_ROOT)->lower;
+	program->depth = PROGRAM_DEPTH_UNKNOWN;
+	return program;
+}
+
+static void free_paging(
+		struct program_paging *paging)
+{
+	if(paging == NULL)
+		return;
+	pthread_mutex_destroy(&paging->lock);
+	free(paging->prev);
+	free(paging->next);
+	free(paging->resident);
+	free(paging);
+}
+
+void gravm_program_destroy(
+		gravm_program_t *self)
+{
+	free_paging(self->paging);
+	free(self->callees);
+	free(self->ids);
+	free(self->pending);
+	free(self->pending_buckets);
+	free(self->pending_next);
+	free(self->removed);
+	pthread_mutex_destroy(&self->lock);
+	switch(self->storage) {
+		case PROGRAM_HEAP:
+			free(self->edges);
+			free(self->nodes);
+			break;
+		case PROGRAM_MAPPED:
+			munmap(self->map, self->map_size);
+			if(self->fd >= 0)
+				close(self->fd);
+			break;
+	}
+	free(self);
+}
+
+int gravm_program_call(
+		gravm_program_t *self,
+		int node,
+		gravm_program_t *callee)
+{
+	gravm_program_t **callees;
+	int i;
+
+	if(node < 0 || node + 1 >= self->n_nodes)
+		return -ENOENT;
+	if(node + 1 >= self->n_callees) {
+		if(callee == NULL)
+			return 0;
+		callees = realloc(self->callees, sizeof(gravm_program_t*) * self->n_nodes);
+		if(callees == NULL)
+			return -ENOMEM;
+		for(i = self->n_callees; i < self->n_nodes; i++)
+			callees[i] = NULL;
+		self->callees = callees;
+		self->n_callees = self->n_nodes;
+	}
+	self->callees[node + 1] = callee;
+	return 0;
+}
+
+int gravm_program_size(
+		gravm_program_t *self)
+{
+	return self->size;
+}
+
+int gravm_program_max_depth(
+		gravm_program_t *self)
+{
+	return program_depth(self);
+}
+
+int program_depth(
+		gravm_program_t *self)
+{
+	int depth;
+
+	depth = program_commit(self);
+	if(depth < 0)
+		return depth;
+	pthread_mutex_lock(&self->lock);
+	if(self->depth == PROGRAM_DEPTH_UNKNOWN || self->depth == -ENOMEM) /* not computed yet, or retry */
+		self->depth = compute_depth(self);
+	depth = self->depth;
+	pthread_mutex_unlock(&self->lock);
+	return depth;
+}
+
+int gravm_program_edge_payload_size(
+		gravm_program_t *self)
+{
+	return self->edge_payload_size;
+}
+
+int gravm_program_node_payload_size(
+		gravm_program_t *self)
+{
+	return self->node_payload_size;
+}
+
+int gravm_program_save(
+		gravm_program_t *self,
+		int fd)
+{
+	static const char padding[PAYLOAD_ALIGN];
+	program_header_t header;
+	uint64_t edges_end;
+	int ret;
+
+	ret = program_commit(self);
+	if(ret < 0)
+		return ret;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, GRAVM_PROGRAM_MAGIC, sizeof(header.magic));
+	header.endian = GRAVM_PROGRAM_ENDIAN;
+	header.version = GRAVM_PROGRAM_VERSION;
+	header.header_size = sizeof(header);
+	header.edge_size = sizeof(edge_entry_t);
+	header.node_size = sizeof(range_t);
+	header.edge_payload_size = self->edge_payload_size;
+	header.node_payload_size = self->node_payload_size;
+	header.n_edges = self->n_edges;
+	header.n_nodes = self->n_nodes;
+	header.edges_offset = PAYLOAD_ALIGN_UP(sizeof(header));
+	edges_end = header.edges_offset + (uint64_t)self->n_edges * self->edge_stride;
+	header.nodes_offset = PAYLOAD_ALIGN_UP(edges_end);
+	header.size = header.nodes_offset + (uint64_t)self->n_nodes * self->node_stride;
+
+	ret = write_all(fd, &header, sizeof(header));
+	if(ret == 0)
+		ret = write_all(fd, padding, header.edges_offset - sizeof(header));
+	if(ret == 0)
+		ret = write_all(fd, self->edges, self->edge_stride * self->n_edges);
+	if(ret == 0)
+		ret = write_all(fd, padding, header.nodes_offset - edges_end);
+	if(ret == 0)
+		ret = write_all(fd, self->nodes, self->node_stride * self->n_nodes);
+	return ret;
+}
+
+/* maps fd read-only; fd may be closed by the caller afterwards */
+static gravm_program_t *map_fd(
+		int fd)
+{
+	gravm_program_t *program;
+	const program_header_t *header;
+	struct stat st;
+	void *map;
+	int ret;
+
+	if(fstat(fd, &st) < 0) {
+		errno = -errno;
+		return NULL;
+	}
+	if(st.st_size < sizeof(program_header_t)) {
+		errno = -EINVAL;
+		return NULL;
+	}
+	map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if(map == MAP_FAILED) {
+		errno = -errno;
+		return NULL;
+	}
+
+	header = map;
+	ret = check_header(header, st.st_size);
+	if(ret < 0)
+		goto error_1;
+
+	program = calloc(1, sizeof(*program));
+	if(program == NULL) {
+		ret = -ENOMEM;
+		goto error_1;
+	}
+	program->storage = PROGRAM_MAPPED;
+	program->fd = -1;
+	program->identity = atomic_fetch_add(&next_identity, 1);
+	pthread_mutex_init(&program->lock, NULL);
+	program->map = map;
+	program->map_size = st.st_size;
+	program->edges = (char*)map + header->edges_offset;
+	program->n_edges = header->n_edges;
+	program->size = header->n_edges;
+	program->edge_payload_size = header->edge_payload_size;
+	program->edge_stride = program_stride(sizeof(edge_entry_t), header->edge_payload_size);
+	program->nodes = (char*)map + header->nodes_offset;
+	program->n_nodes = header->n_nodes;
+	program->node_payload_size = header->node_payload_size;
+	program->node_stride = program_stride(sizeof(range_t), header->node_payload_size);
+	program->depth = PROGRAM_DEPTH_UNKNOWN;
+	return program;
+
+error_1:
+	munmap(map, st.st_size);
+	errno = ret;
+	return NULL;
+}
+
+static int shared_fd()
+{
+#ifdef MFD_ALLOW_SEALING
+	int fd = memfd_create("gravm-program", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+	if(fd < 0)
+		return -errno;
+	return fd;
+#else
+	char name[64];
+	int fd;
+
+	snprintf(name, sizeof(name), "/gravm-program-%ld-%p", (long)getpid(), (void*)&name);
+	fd = shm_open(name, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+	if(fd < 0)
+		return -errno;
+	shm_unlink(name);
+	return fd;
+#endif
+}
+
+gravm_program_t *gravm_program_map(
+		const char *path)
+{
+	gravm_program_t *program;
+	int fd;
+
+	fd = open(path, O_RDONLY | O_CLOEXEC);
+	if(fd < 0) {
+		errno = -errno;
+		return NULL;
+	}
+	program = map_fd(fd);
+	close(fd);
+	return program;
+}
+
+gravm_program_t *gravm_program_share(
+		gravm_program_t *self)
+{
+	gravm_program_t *program;
+	int fd;
+	int ret;
+
+	fd = shared_fd();
+	if(fd < 0) {
+		errno = fd;
+		return NULL;
+	}
+	ret = gravm_program_save(self, fd);
+	if(ret < 0)
+		goto error_1;
+#ifdef MFD_ALLOW_SEALING
+	if(fcntl(fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_WRITE | F_SEAL_SEAL) < 0) {
+		ret = -errno;
+		goto error_1;
+	}
+#endif
+
+	program = map_fd(fd);
+	if(program == NULL) {
+		ret = errno;
+		goto error_1;
+	}
+	program->fd = fd;
+	return program;
+
+error_1:
+	close(fd);
+	errno = ret;
+	return NULL;
+}
+
+gravm_program_t *gravm_program_attach(
+		int fd)
+{
+	return map_fd(fd);
+}
+
+static void paging_unlink(
+		struct program_paging *paging,
+		int chunk)
+{
+	if(paging->prev[chunk] >= 0)
+		paging->next[paging->prev[chunk]] = paging->next[chunk];
+	else
+		paging->head = paging->next[chunk];
+	if(paging->next[chunk] >= 0)
+		paging->prev[paging->next[chunk]] = paging->prev[chunk];
+	else
+		paging->tail = paging->prev[chunk];
+}
+
+static void paging_push_front(
+		struct program_paging *paging,
+		int chunk)
+{
+	paging->prev[chunk] = -1;
+	paging->next[chunk] = paging->head;
+	if(paging->head >= 0)
+		paging->prev[paging->head] = chunk;
+	else
+		paging->tail = chunk;
+	paging->head = chunk;
+}
+
+/* madvise() on chunk 'chunk'; the last one may be shorter */
+static void paging_advise(
+		gravm_program_t *self,
+		int chunk,
+		int advice)
+{
+	size_t offset = (size_t)chunk * self->paging->chunk;
+	size_t size = self->paging->chunk;
+
+	if(offset + size > self->map_size)
+		size = self->map_size - offset;
+	madvise((char*)self->map + offset, size, advice);
+}
+
+static void paging_touch_chunk(
+		gravm_program_t *self,
+		int chunk)
+{
+	struct program_paging *paging = self->paging;
+	int victim;
+
+	if(paging->resident[chunk]) {
+		if(paging->head != chunk) {
+			paging_unlink(paging, chunk);
+			paging_push_front(paging, chunk);
+		}
+		return;
+	}
+	paging_advise(self, chunk, MADV_WILLNEED);
+	paging->resident[chunk] = true;
+	paging_push_front(paging, chunk);
+	paging->n_resident++;
+	while(paging->n_resident > 1 && (size_t)paging->n_resident * paging->chunk > paging->max_bytes) {
+		victim = paging->tail;
+		paging_unlink(paging, victim);
+		paging->resident[victim] = false;
+		paging->n_resident--;
+		paging_advise(self, victim, MADV_DONTNEED);
+	}
+}
+
+/* edges [lower, upper) */
+static void paging_touch_edges(
+		gravm_program_t *self,
+		int lower,
+		int upper)
+{
+	size_t first;
+	size_t last;
+	size_t i;
+
+	if(lower >= upper)
+		return;
+	first = ((char*)program_edge(self, lower) - (char*)self->map) / self->paging->chunk;
+	last = ((char*)program_edge(self, upper) - 1 - (char*)self->map) / self->paging->chunk;
+	for(i = first; i <= last; i++)
+		paging_touch_chunk(self, i);
+}
+
+void program_page_in(
+		gravm_program_t *self,
+		int node)
+{
+	const range_t *range = program_node(self, node);
+	const range_t *child;
+	int upper;
+	int i;
+
+	pthread_mutex_lock(&self->paging->lock);
+	/* children first, so the edges about to be iterated are the most recently used ones */
+	upper = range->upper < range->lower + PAGING_PREFETCH ? range->upper : range->lower + PAGING_PREFETCH;
+	for(i = range->lower; i < upper; i++) {
+		child = program_node(self, program_edge(self, i)->target);
+		paging_touch_edges(self, child->lower, child->upper < child->lower + PAGING_PREFETCH ? child->upper : child->lower + PAGING_PREFETCH);
+	}
+	paging_touch_edges(self, range->lower, range->upper);
+	pthread_mutex_unlock(&self->paging->lock);
+}
+
+int gravm_program_set_residency(
+		gravm_program_t *self,
+		size_t max_bytes)
+{
+	struct program_paging *paging;
+	long page = sysconf(_SC_PAGESIZE);
+	int i;
+
+	if(self->storage != PROGRAM_MAPPED)
+		return -EINVAL;
+	free_paging(self->paging);
+	self->paging = NULL;
+	if(max_bytes == 0)
+		return 0;
+
+	paging = calloc(1, sizeof(*paging));
+	if(paging == NULL)
+		return -ENOMEM;
+	paging->chunk = page > PAGING_CHUNK ? page : PAGING_CHUNK;
+	paging->n_chunks = (self->map_size + paging->chunk - 1) / paging->chunk;
+	paging->prev = malloc(sizeof(int) * paging->n_chunks);
+	paging->next = malloc(sizeof(int) * paging->n_chunks);
+	paging->resident = calloc(paging->n_chunks, 1);
+	pthread_mutex_init(&paging->lock, NULL);
+	if(paging->prev == NULL || paging->next == NULL || paging->resident == NULL) {
+		free_paging(paging);
+		return -ENOMEM;
+	}
+	for(i = 0; i < paging->n_chunks; i++)
+		paging->prev[i] = paging->next[i] = -1;
+	paging->head = paging->tail = -1;
+	paging->max_bytes = max_bytes;
+	self->paging = paging;
+	return 0;
+}
+
+int gravm_program_fd(
+		gravm_program_t *self)
+{
+	if(self->fd < 0)
+		return -ENOENT;
+	return self->fd;
+}
+
+static edge_entry_t *pending_edge(
+		const gravm_program_t *self,
+		int index)
+{
+	return (edge_entry_t*)(self->pending + (size_t)index * self->edge_stride);
+}
+
+static int pending_bucket(
+		const gravm_program_t *self,
+		int id)
+{
+	uint64_t h = (uint64_t)(unsigned int)id * 0x9e3779b97f4a7c15ULL;
+	return (int)(h >> 32) & (self->pending_capacity - 1);
+}
+
+/* pending record with the given id, removed or not; -1 if there is none */
+static int pending_find(
+		const gravm_program_t *self,
+		int id)
+{
+	int i;
+
+	if(self->pending_capacity == 0)
+		return -1;
+	for(i = self->pending_buckets[pending_bucket(self, id)]; i >= 0; i = self->pending_next[i])
+		if(pending_edge(self, i)->id == id)
+			return i;
+	return -1;
+}
+
+/* makes room for one more pending record. the hash table is resized along with the records and rebuilt */
+static int pending_grow(
+		gravm_program_t *self)
+{
+	char *pending;
+	int *buckets;
+	int *next;
+	int capacity;
+	int b;
+	int i;
+
+	if(self->n_pending < self->pending_capacity)
+		return 0;
+	capacity = self->pending_capacity < 8 ? 16 : self->pending_capacity * 2;
+	pending = realloc(self->pending, self->edge_stride * capacity);
+	if(pending == NULL)
+		return -ENOMEM;
+	self->pending = pending;
+	next = realloc(self->pending_next, sizeof(int) * capacity);
+	if(next == NULL)
+		return -ENOMEM;
+	self->pending_next = next;
+	buckets = realloc(self->pending_buckets, sizeof(int) * capacity);
+	if(buckets == NULL)
+		return -ENOMEM;
+	self->pending_buckets = buckets;
+	self->pending_capacity = capacity;
+
+	for(b = 0; b < capacity; b++)
+		buckets[b] = -1;
+	for(i = 0; i < self->n_pending; i++) {
+		b = pending_bucket(self, pending_edge(self, i)->id);
+		next[i] = buckets[b];
+		buckets[b] = i;
+	}
+	return 0;
+}
+
+static bool is_removed(
+		const gravm_program_t *self,
+		int index)
+{
+	return self->removed != NULL && (self->removed[index / 64] & ((uint64_t)1 << (index % 64))) != 0;
+}
+
+/* position of the edge 'id' in the edge array, pending edits not taken into account. -ENOENT if there is none */
+static int compiled_find(
+		gravm_program_t *self,
+		int id)
+{
+	int ret = 0;
+	int i;
+
+	pthread_mutex_lock(&self->lock);
+	if(self->ids == NULL)
+		ret = build_ids(self);
+	pthread_mutex_unlock(&self->lock);
+	if(ret < 0)
+		return ret;
+	i = ids_lower_bound(self, self->n_edges, id);
+	if(i == self->n_edges || self->ids[i].id != id)
+		return -ENOENT;
+	return self->ids[i].index;
+}
+
+/* merges the edges of each block which have not been removed with the pending edges of the block's node, see
+ * program_commit(). self->lock must be held */
+static int apply_edits(
+		gravm_program_t *self)
+{
+	range_t *range;
+	id_entry_t *added = NULL; /* ids of the pending edges and their new positions */
+	id_entry_t *ids = NULL;
+	edge_entry_t *cur;
+	char *edges = NULL;
+	bool *placed = NULL;
+	int *order = NULL;
+	int *first = NULL; /* per node table entry: first pending edge of the node after sorting */
+	int *moved = NULL; /* new position of each edge of the edge array */
+	int n_added = 0;
+	int n_order = 0;
+	int n;
+	int node;
+	int upper;
+	int pos = 0;
+	int a;
+	int b;
+	int i;
+	int ret = -ENOMEM;
+
+	/* live pending edges to the front, sorted like the blocks */
+	for(i = 0; i < self->n_pending; i++)
+		if(pending_edge(self, i)->target >= 0)
+			memmove(pending_edge(self, n_added++), pending_edge(self, i), self->edge_stride);
+	if(n_added > 0)
+		qsort(self->pending, n_added, self->edge_stride, cmp_full);
+	n = self->n_edges - self->n_removed + n_added;
+
+	edges = malloc(self->edge_stride * n);
+	order = malloc(sizeof(int) * self->n_nodes);
+	placed = calloc(self->n_nodes, sizeof(bool));
+	first = malloc(sizeof(int) * (self->n_nodes + 1));
+	if(self->ids != NULL) {
+		moved = malloc(sizeof(int) * (self->n_edges > 0 ? self->n_edges : 1));
+		added = malloc(sizeof(id_entry_t) * (n_added > 0 ? n_added : 1));
+		ids = malloc(sizeof(id_entry_t) * n);
+	}
+	if(edges == NULL || order == NULL || placed == NULL || first == NULL || (self->ids != NULL && (moved == NULL || added == NULL || ids == NULL)))
+		goto out;
+
+	/* blocks in their current order, followed by the empty ones */
+	for(i = 0; i < self->n_edges; i++) {
+		node = program_edge(self, i)->source + 1;
+		if(!placed[node]) {
+			placed[node] = true;
+			order[n_order++] = node;
+		}
+	}
+	for(i = 0; i < self->n_nodes; i++)
+		if(!placed[i])
+			order[n_order++] = i;
+	for(i = 0, a = 0; i <= self->n_nodes; i++) {
+		while(a < n_added && pending_edge(self, a)->source + 1 < i)
+			a++;
+		first[i] = a;
+	}
+
+	for(i = 0; i < self->n_nodes; i++) {
+		node = order[i];
+		range = program_node(self, node - 1);
+		a = range->lower;
+		upper = range->upper;
+		b = first[node];
+		range->lower = pos;
+		range->boundary = -1;
+		while(a < upper || b < first[node + 1]) {
+			if(a < upper && is_removed(self, a)) {
+				a++;
+				continue;
+			}
+			else if(b == first[node + 1] || (a < upper && cmp_full(program_edge(self, a), pending_edge(self, b)) < 0)) {
+				if(moved != NULL)
+					moved[a] = pos;
+				cur = program_edge(self, a++);
+			}
+			else {
+				if(added != NULL) {
+					added[b].id = pending_edge(self, b)->id;
+					added[b].index = pos;
+				}
+				cur = pending_edge(self, b++);
+			}
+			if(range->boundary < 0 && cur->priority >= 0)
+				range->boundary = pos;
+			memcpy(edges + self->edge_stride * pos++, cur, self->edge_stride);
+		}
+		range->upper = pos;
+		if(range->boundary < 0)
+			range->boundary = pos;
+	}
+	assert(pos == n);
+
+	/* the id index stays sorted: merge the remaining entries with the added ones */
+	if(self->ids != NULL) {
+		qsort(added, n_added, sizeof(id_entry_t), cmp_id);
+		for(i = 0, a = 0, b = 0; i < n; i++) {
+			while(a < self->n_edges && is_removed(self, self->ids[a].index))
+				a++;
+			if(b == n_added || (a < self->n_edges && self->ids[a].id < added[b].id)) {
+				ids[i].id = self->ids[a].id;
+				ids[i].index = moved[self->ids[a++].index];
+			}
+			else
+				ids[i] = added[b++];
+		}
+		free(self->ids);
+		self->ids = ids;
+		ids = NULL;
+	}
+
+	free(self->edges);
+	self->edges = edges;
+	self->n_edges = n;
+	edges = NULL;
+	n_added = 0;
+	free(self->removed);
+	self->removed = NULL;
+	self->n_removed = 0;
+	ret = 0;
+out:
+	/* the records left are still pending, chained anew */
+	self->n_pending = n_added;
+	for(i = 0; i < self->pending_capacity; i++)
+		self->pending_buckets[i] = -1;
+	for(i = 0; i < self->n_pending; i++) {
+		b = pending_bucket(self, pending_edge(self, i)->id);
+		self->pending_next[i] = self->pending_buckets[b];
+		self->pending_buckets[b] = i;
+	}
+	free(ids);
+	free(added);
+	free(moved);
+	free(first);
+	free(placed);
+	free(order);
+	free(edges);
+	return ret;
+}
+
+int program_commit(
+		gravm_program_t *self)
+{
+	int ret = 0;
+
+	pthread_mutex_lock(&self->lock);
+	if(self->n_pending > 0 || self->n_removed > 0)
+		ret = apply_edits(self);
+	pthread_mutex_unlock(&self->lock);
+	return ret;
+}
+
+int program_find(
+		gravm_program_t *self,
+		int id)
+{
+	int ret;
+
+	ret = program_commit(self);
+	if(ret < 0)
+		return ret;
+	return compiled_find(self, id);
+}
+
+int program_edge_insert(
+		gravm_program_t *self,
+		int id,
+		const gravm_runstack_edgedef_t *def,
+		const gravm_runstack_callback_t *cb,
+		void *user)
+{
+	edge_entry_t *entry;
+	int index;
+	int b;
+	int ret;
+
+	if(self->storage != PROGRAM_HEAP)
+		return -EPERM;
+	else if(def->target < 0 || def->source < GRAVM_RS_ROOT)
+		return -EINVAL;
+	index = pending_find(self, id);
+	if(index >= 0 && pending_edge(self, index)->target >= 0)
+		return -EEXIST;
+	ret = compiled_find(self, id);
+	if(ret >= 0 && !is_removed(self, ret))
+		return -EEXIST;
+	else if(ret < 0 && ret != -ENOENT)
+		return ret;
+
+	ret = grow_nodes(self, def->source > def->target ? def->source : def->target, cb, user);
+	if(ret < 0)
+		return ret;
+	if(index < 0) { /* otherwise the record of an edge removed before is reused */
+		ret = pending_grow(self);
+		if(ret < 0)
+			return ret;
+		index = self->n_pending;
+	}
+
+	entry = pending_edge(self, index);
+	memset(entry, 0, self->edge_stride);
+	entry->id = id;
+	entry->source = def->source;
+	entry->priority = def->priority;
+	entry->target = def->target;
+	if(self->edge_payload_size > 0 && cb->edge_payload != NULL) {
+		ret = cb->edge_payload(user, id, program_edge_payload(entry));
+		if(ret < 0) { /* the edge has not been added */
+			entry->target = -1;
+			return ret;
+		}
+	}
+	if(index == self->n_pending) {
+		b = pending_bucket(self, id);
+		self->pending_next[index] = self->pending_buckets[b];
+		self->pending_buckets[b] = index;
+		self->n_pending++;
+	}
+
+	self->size++;
+	if(def->source == GRAVM_RS_ROOT)
+		self->root_edges++;
+	self->identity = atomic_fetch_add(&next_identity, 1);
+	self->depth = PROGRAM_DEPTH_UNKNOWN;
+	return 0;
+}
+
+int program_edge_remove(
+		gravm_program_t *self,
+		int id)
+{
+	edge_entry_t *entry;
+	int index;
+	int pos = -1;
+
+	if(self->storage != PROGRAM_HEAP)
+		return -EPERM;
+	index = pending_find(self, id);
+	if(index >= 0 && pending_edge(self, index)->target >= 0)
+		entry = pending_edge(self, index);
+	else {
+		pos = compiled_find(self, id);
+		if(pos >= 0 && is_removed(self, pos))
+			return -ENOENT;
+		else if(pos < 0)
+			return pos;
+		entry = program_edge(self, pos);
+	}
+	if(entry->source == GRAVM_RS_ROOT && self->root_edges == 1) /* last root edge */
+		return -EINVAL;
+
+	if(pos < 0)
+		entry->target = -1;
+	else {
+		if(self->removed == NULL) {
+			self->removed = calloc((self->n_edges + 63) / 64, sizeof(uint64_t));
+			if(self->removed == NULL)
+				return -ENOMEM;
+		}
+		self->removed[pos / 64] |= (uint64_t)1 << (pos % 64);
+		self->n_removed++;
+	}
+
+	self->size--;
+	if(entry->source == GRAVM_RS_ROOT)
+		self->root_edges--;
+	self->identity = atomic_fetch_add(&next_identity, 1);
+	self->depth = PROGRAM_DEPTH_UNKNOWN;
+	return 0;
+}
+
+int program_relayout(
+		gravm_program_t *self,
+		const unsigned int *counts,
+		int n_counts)
+{
+	weighted_node_t *nodes;
+	const edge_entry_t *cur;
+	int *order;
+	int i;
+	int j;
+	int ret;
+
+	if(self->storage != PROGRAM_HEAP)
+		return -EPERM;
+	ret = program_commit(self);
+	if(ret < 0)
+		return ret;
+
+	ret = -ENOMEM;
+	nodes = malloc(sizeof(weighted_node_t) * self->n_nodes);
+	order = malloc(sizeof(int) * self->n_nodes);
+	if(nodes == NULL || order == NULL)
+		goto out;
+	for(i = 0; i < self->n_nodes; i++) {
+		nodes[i].node = i;
+		nodes[i].weight = 0;
+		for(j = program_node(self, i - 1)->lower; j < program_node(self, i - 1)->upper; j++) {
+			cur = program_edge(self, j);
+			if(cur->id >= 0 && cur->id < n_counts)
+				nodes[i].weight += counts[cur->id];
+		}
+	}
+	qsort(nodes, self->n_nodes, sizeof(weighted_node_t), cmp_weight);
+	for(i = 0; i < self->n_nodes; i++)
+		order[i] = nodes[i].node;
+
+	ret = place_blocks(self, order);
+out:
+	free(order);
+	free(nodes);
+	return ret;
+}
+
+/***** versioning *****/
+
+/* slot lock must be held */
+static int reclaim(
+		gravm_program_slot_t *self)
+{
+	slot_reader_t *reader;
+	retired_t **cur;
+	retired_t *old;
+	uint64_t min = UINT64_MAX;
+	uint64_t epoch;
+	int pending = 0;
+
+	for(reader = self->readers; reader != NULL; reader = reader->next) {
+		epoch = atomic_load(&reader->epoch);
+		if(epoch != SLOT_IDLE && epoch < min)
+			min = epoch;
+	}
+
+	/* a reader having pinned during epoch e may use any program retired during epoch e or later */
+	cur = &self->retired;
+	while(*cur != NULL) {
+		if((*cur)->epoch < min) {
+			old = *cur;
+			*cur = old->next;
+			gravm_program_destroy(old->program);
+			free(old);
+		}
+		else {
+			pending++;
+			cur = &(*cur)->next;
+		}
+	}
+	return pending;
+}
+
+slot_reader_t *slot_register(
+		gravm_program_slot_t *slot)
+{
+	slot_reader_t *reader;
+
+	reader = calloc(1, sizeof(*reader));
+	if(reader == NULL)
+		return NULL;
+	atomic_init(&reader->epoch, SLOT_IDLE);
+	reader->slot = slot;
+	pthread_mutex_lock(&slot->lock);
+	reader->next = slot->readers;
+	slot->readers = reader;
+	pthread_mutex_unlock(&slot->lock);
+	return reader;
+}
+
+void slot_unregister(
+		slot_reader_t *reader)
+{
+	gravm_program_slot_t *slot = reader->slot;
+	slot_reader_t **cur;
+
+	pthread_mutex_lock(&slot->lock);
+	for(cur = &slot->readers; *cur != reader; cur = &(*cur)->next)
+		assert(*cur != NULL);
+	*cur = reader->next;
+	pthread_mutex_unlock(&slot->lock);
+	free(reader);
+}
+
+gravm_program_t *slot_pin(
+		slot_reader_t *reader)
+{
+	/* announce the epoch before loading the program; a publisher swaps the program before advancing the epoch,
+	 * so a reader can only obtain a program which has been retired during its announced epoch or later */
+	atomic_store(&reader->epoch, atomic_load(&reader->slot->epoch));
+	return atomic_load(&reader->slot->current);
+}
+
+void slot_unpin(
+		slot_reader_t *reader)
+{
+	atomic_store(&reader->epoch, SLOT_IDLE);
+}
+
+gravm_program_slot_t *gravm_program_slot_new(
+		gravm_program_t *program)
+{
+	gravm_program_slot_t *slot;
+
+	slot = calloc(1, sizeof(*slot));
+	if(slot == NULL) {
+		errno = -ENOMEM;
+		return NULL;
+	}
+	if(pthread_mutex_init(&slot->lock, NULL) != 0) {
+		free(slot);
+		errno = -ENOMEM;
+		return NULL;
+	}
+	atomic_init(&slot->current, program);
+	atomic_init(&slot->epoch, SLOT_IDLE + 1);
+	return slot;
+}
+
+void gravm_program_slot_destroy(
+		gravm_program_slot_t *self)
+{
+	retired_t *cur;
+	retired_t *old;
+
+	assert(self->readers == NULL);
+	cur = self->retired;
+	while(cur != NULL) {
+		old = cur;
+		cur = cur->next;
+		gravm_program_destroy(old->program);
+		free(old);
+	}
+	gravm_program_destroy(atomic_load(&self->current));
+	pthread_mutex_destroy(&self->lock);
+	free(self);
+}
+
+int gravm_program_slot_publish(
+		gravm_program_slot_t *self,
+		gravm_program_t *program)
+{
+	retired_t *retired;
+
+	retired = calloc(1, sizeof(*retired));
+	if(retired == NULL)
+		return -ENOMEM;
+
+	pthread_mutex_lock(&self->lock);
+	retired->program = atomic_exchange(&self->current, program);
+	retired->epoch = atomic_load(&self->epoch);
+	retired->next = self->retired;
+	self->retired = retired;
+	atomic_fetch_add(&self->epoch, 1);
+	reclaim(self);
+	pthread_mutex_unlock(&self->lock);
+
+	return 0;
+}
+
+int gravm_program_slot_reclaim(
+		gravm_program_slot_t *self)
+{
+	int pending;
+
+	pthread_mutex_lock(&self->lock);
+	pending = reclaim(self);
+	pthread_mutex_unlock(&self->lock);
+	return pending;
+}
+
+#ifdef TESTING
+#include "../test/program.h"
+#endif
+
@@ -0,0 +1,235 @@
+#pragma once
+
+#include <stddef.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <pthread.h>
+
+#include <gravm/program.h>
+
+#define GRAVM_PROGRAM_MAGIC "GRAVMPRG"
+#define GRAVM_PROGRAM_ENDIAN 0x01020304
+#define GRAVM_PROGRAM_VERSION 3
+
+#define SLOT_IDLE 0
+
+#define GRAVM_PROGRAM_MAX_THREADS 64
+#define GRAVM_PROGRAM_MIN_SHARD 65536 /* minimum number of edges per thread when compiling in parallel */
+
+#define PROGRAM_DEPTH_UNKNOWN INT_MIN /* see program_depth() */
+
+#define PAYLOAD_ALIGN 8 /* alignment of user payloads, relative to the beginning of the edge/node array */
+#define PAYLOAD_ALIGN_UP(X) (((X) + PAYLOAD_ALIGN - 1) & ~(size_t)(PAYLOAD_ALIGN - 1))
+
+enum {
+	PROGRAM_HEAP,
+	PROGRAM_MAPPED
+};
+
+typedef struct {
+	int source; /* source node index as used in squirrel; -1: root */
+	int priority;
+	int target; /* target node index as used in squirrel */
+	int id; /* edge index as used in squirrel */
+} edge_entry_t;
+
+/* outgoing edges of a node, as indices into the edge array. nodes without outgoing edges have
+ * an empty range positioned where their edges would be inserted */
+typedef struct {
+	int lower;
+	int boundary; /* boundary between pre-/post-outgoing edges (boundary = upper_pre = lower_post) */
+	int upper;
+} range_t;
+
+/* entry of the edge id index, see program_find() */
+typedef struct {
+	int id;
+	int index; /* position in the edge array */
+} id_entry_t;
+
+/* on-disk header; all fields are stored in host byte order, 'endian' tells readers which one that was */
+typedef struct {
+	char magic[8];
+	uint32_t endian;
+	uint32_t version;
+	uint32_t header_size;
+	uint32_t edge_size; /* sizeof(edge_entry_t) */
+	uint32_t node_size; /* sizeof(range_t) */
+	uint32_t edge_payload_size;
+	uint32_t node_payload_size;
+	int32_t n_edges;
+	int32_t n_nodes;
+	uint64_t edges_offset; /* byte offset of the edge array, relative to the beginning of the file */
+	uint64_t nodes_offset; /* byte offset of the node range table */
+	uint64_t size; /* total size of the file */
+} program_header_t;
+
+struct gravm_program {
+	int storage;
+	void *map; /* PROGRAM_MAPPED: mmap()ed file */
+	size_t map_size;
+	int fd; /* shared memory segment created by gravm_program_share(); -1: none */
+
+	/* records of edge_stride bytes: an edge_entry_t followed by the edge payload, see program_edge().
+	 * one block per source node, sorted according to cmp_full within the block. blocks are ordered by
+	 * node id unless another layout has been requested. read-only in case of PROGRAM_MAPPED */
+	char *edges;
+	int n_edges;
+	size_t edge_stride;
+	int edge_payload_size;
+
+	/* records of node_stride bytes: a range_t followed by the node payload, see program_node().
+	 * index 0: root, index x + 1: node x; covers every node referenced by an edge */
+	char *nodes;
+	int n_nodes;
+	int nodes_capacity; /* PROGRAM_HEAP: allocated number of nodes */
+	size_t node_stride;
+	int node_payload_size;
+
+	/* PROGRAM_HEAP: edits which have not been applied to the edge array yet, see program_commit() */
+	char *pending; /* added edges, records like in 'edges'; target -1: removed again */
+	int n_pending;
+	int pending_capacity; /* also the number of hash buckets, a power of two */
+	int *pending_buckets; /* first pending record of each hash chain; -1: empty */
+	int *pending_next; /* next record in the hash chain of each pending record */
+	uint64_t *removed; /* one bit per edge of the edge array; NULL: none removed */
+	int n_removed;
+	int size; /* number of edges, pending edits included */
+	int root_edges; /* number of root edges, pending edits included */
+
+	uint64_t identity; /* unique per program and changed by edits, so cache entries of different programs never match */
+
+	pthread_mutex_t lock; /* protects applying the pending edits and building the lazily derived data below */
+	id_entry_t *ids; /* n_edges entries sorted by id, pending edits not included; NULL: not built yet */
+	int depth; /* see program_depth(); PROGRAM_DEPTH_UNKNOWN: not computed yet */
+	struct program_paging *paging; /* PROGRAM_MAPPED: see gravm_program_set_residency(); NULL: disabled */
+
+	gravm_program_t **callees; /* per node table entry, see gravm_program_call(); NULL: no calls */
+	int n_callees;
+};
+
+/* size of a record consisting of 'size' bytes followed by 'payload' bytes of payload */
+static inline size_t program_stride(
+		size_t size,
+		int payload)
+{
+	if(payload == 0)
+		return size;
+	return PAYLOAD_ALIGN_UP(PAYLOAD_ALIGN_UP(size) + payload);
+}
+
+static inline edge_entry_t *program_edge(
+		const gravm_program_t *self,
+		int index)
+{
+	return (edge_entry_t*)(self->edges + (size_t)index * self->edge_stride);
+}
+
+static inline range_t *program_node(
+		const gravm_program_t *self,
+		int node)
+{
+	return (range_t*)(self->nodes + (size_t)(node + 1) * self->node_stride);
+}
+
+static inline void *program_edge_payload(
+		const edge_entry_t *edge)
+{
+	return (char*)edge + PAYLOAD_ALIGN_UP(sizeof(edge_entry_t));
+}
+
+static inline void *program_node_payload(
+		const range_t *node)
+{
+	return (char*)node + PAYLOAD_ALIGN_UP(sizeof(range_t));
+}
+
+/* program called by 'node', see gravm_program_call(); NULL if none */
+static inline gravm_program_t *program_callee(
+		const gravm_program_t *self,
+		int node)
+{
+	if(node + 1 >= self->n_callees)
+		return NULL;
+	return self->callees[node + 1];
+}
+
+/* pages in the outgoing edges of 'node' and prefetches those of its first children, evicting the least recently
+ * used parts of the mapping if the residency limit is exceeded */
+void program_page_in(
+		gravm_program_t *self,
+		int node);
+
+/* to be called before the outgoing edges of 'node' are iterated; cheap unless paging is enabled */
+static inline void program_touch(
+		gravm_program_t *self,
+		int node)
+{
+	if(self->paging != NULL)
+		program_page_in(self, node);
+}
+
+typedef struct slot_reader slot_reader_t;
+
+/* a runstack using a gravm_program_slot_t. 'epoch' is written by the reader only and read by publishers */
+struct slot_reader {
+	_Atomic uint64_t epoch; /* epoch during which the current program has been pinned; SLOT_IDLE: none */
+	gravm_program_slot_t *slot;
+	slot_reader_t *next;
+};
+
+/* register/unregister take the slot lock; pin/unpin are lock-free and only touch the reader's own epoch */
+slot_reader_t *slot_register(
+		gravm_program_slot_t *slot);
+
+void slot_unregister(
+		slot_reader_t *reader);
+
+gravm_program_t *slot_pin(
+		slot_reader_t *reader);
+
+void slot_unpin(
+		slot_reader_t *reader);
+
+/* applies the pending edits to the edge array, the node range table and the id index (if built): the k pending
+ * edges are sorted and merged into the blocks of their source nodes, removed edges are dropped, in O(n + k log k)
+ * overall. called before anything reads the edge array, i.e. when a run begins. new blocks are appended, all
+ * others keep their place. fails with -ENOMEM, leaving the edits pending */
+int program_commit(
+		gravm_program_t *self);
+
+/* index of the edge with the given id, -ENOENT if there is none; commits pending edits first. the id index is built
+ * on first use, which may fail with -ENOMEM; lookups are O(log n) afterwards */
+int program_find(
+		gravm_program_t *self,
+		int id);
+
+/* edits are recorded as pending (see program_commit()) instead of moving the edges of the edge array, so each one
+ * costs an O(log n) lookup in the id index plus an expected O(1) lookup in the hash table of the pending edges
+ * (amortized, as the tables grow by doubling). only the payload callbacks are invoked, for the new edge and for
+ * nodes not known before; if the edge payload callback fails, the edge is not added. PROGRAM_HEAP only */
+int program_edge_insert(
+		gravm_program_t *self,
+		int id,
+		const gravm_runstack_edgedef_t *def,
+		const gravm_runstack_callback_t *cb,
+		void *user);
+
+int program_edge_remove(
+		gravm_program_t *self,
+		int id);
+
+/* maximum number of frames needed to execute the program depth-first, -ELOOP if the root reaches a cycle.
+ * computed by a walk over the whole program on first use after the program has been created or changed, so mapping
+ * or editing a program does not touch all of its edges. the result is kept unless the computation failed with
+ * -ENOMEM */
+int program_depth(
+		gravm_program_t *self);
+
+/* orders the node blocks by descending sum of the counts of their edges; PROGRAM_HEAP only */
+int program_relayout(
+		gravm_program_t *self,
+		const unsigned int *counts,
+		int n_counts);
@@ -4,11 +4,16 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <errno.h>
-#include <btree/memory.h>
+#include <stdint.h>
+#include <stdatomic.h>
 
 #include "config.h"
+#include "program_private.h"
+#include "cache_private.h"
+#include "trace_private.h"
 
 #include <gravm/runstack.h>
+#include <gravm/program.h>
 
 #define EXEC_EXCEPTION_CASES \
 	case GRAVM_RS_THROW: \
@@ -23,6 +28,9 @@
 		self->state = GRAVM_RS_STATE_EXECUTED_ERROR; \
 		return;
 
+/* internal gravm_runstack_step() result of a lane waiting in front of node_run, see run_lanes() */
+#define LANE_PARKED (GRAVM_RS_UNKNOWN - 1)
+
 #define THROW_EXCEPTION_CASES \
 	case GRAVM_RS_THROW: \
 	case GRAVM_RS_FATAL: \
@@ -33,6 +41,16 @@
 		self->state = GRAVM_RS_STATE_EXECUTED_ERROR; \
 		return;
 
+/* records the instruction about to be executed; compiled out unless built with GRAVM_TRACE */
+#ifdef GRAVM_TRACE
+#define TRACE_STEP(SELF) \
+	if((SELF)->trace != NULL) \
+		trace_write((SELF)->trace, (SELF)->lane_index, (SELF)->top->edge->id, (SELF)->top->edge->target, (SELF)->top->ip, \
+				(SELF)->state);
+#else
+#define TRACE_STEP(SELF)
+#endif
+
 #define THROW_FATAL_CASES \
 	case GRAVM_RS_FATAL: \
 		self->state = GRAVM_RS_STATE_EXECUTED_ERROR; \
@@ -44,34 +62,52 @@
 
 typedef struct stackframe stackframe_t;
 
+static _Atomic uint64_t next_mask_key = 1;
+
+/* kinds of outgoing edges, in the order they are executed, see begin_outgoing() */
+enum {
+	OUT_PROGRAM, /* edges of the frame's program */
+	OUT_EMITTED, /* see gravm_runstack_emit() */
+	OUT_CALLEE, /* root edges of the program called by the node (post edges only), see gravm_program_call() */
+	OUT_DONE
+};
+
 typedef struct {
-	btree_it_t it;
+	int index; /* index into program edges */
 	int lower;
 	int upper;
+	const uint64_t *mask; /* skip edges whose id is not set, see it_begin_enabled(); NULL: visit all edges */
+	gravm_program_t *program; /* program of the edges, and of the frames pushed for them */
+	const edge_entry_t *emitted; /* iterate over these edges instead of the program edges, see it_element() */
 } iterator_t;
 
-typedef struct {
-	int source; /* source node index as used in squirrel; -1: root */
-	int priority;
-	int target; /* target node index as used in squirrel */
-	int id; /* edge index as used in squirrel */
-
-	/* following fields are indices into btree. they specify outgoing edges on the 'target' node of this edge. -1: not available*/
-	int out_lower;
-	int out_boundary; /* boundary between pre-/post-outgoing edges (out_boundary = out_upper_pre = out_lower_post) */
-	int out_upper;
-} edge_entry_t;
-
 struct stackframe {
 	stackframe_t *prev;
-	edge_entry_t *edge;
+	gravm_program_t *program; /* program of 'edge' and 'out'; differs from the runstack's one below a call */
+	const edge_entry_t *edge;
+	const range_t *out; /* outgoing edges of edge->target */
 	int ip;
 	int iteration; /* iteration couter for current edge */
 
 	iterator_t out_it;
-	edge_entry_t *out_cur; /* represents casted out_it.element; if NULL, iterator has reached its end */
+	const edge_entry_t *out_cur; /* represents element at out_it.index; if NULL, iterator has reached its end */
 	int out_upper; /* upper index in loops pre-/post outgoing edges */
 	int out_nextip; /* next ip to jump to when iteration is finished */
+	int out_phase; /* OUT_*: which kind of outgoing edges out_it iterates over */
+	bool cache_store; /* store the child frame under 'fingerprint' when ascending */
+	bool retain; /* GRAVM_RS_OPT_INCREMENTAL: retain the child frame when ascending */
+	bool out_prepared; /* GRAVM_RS_OPT_LAZY_PREPARE: out_cur has been prepared and not been unprepared yet */
+	bool emitted; /* 'edge' has been emitted by the parent node, i.e. is not part of the program */
+	bool called; /* 'edge' is executed below a call (see gravm_program_call()), even if 'program' is the runstack's */
+	uint64_t fingerprint;
+
+	/* edges emitted by node_enter using gravm_runstack_emit(), sorted by priority. pre edges: [0, emitted_boundary),
+	 * post edges: [emitted_boundary, n_emitted). iterated after the outgoing edges of the program. the buffer is kept
+	 * when the frame is recycled */
+	edge_entry_t *emitted_edges;
+	int n_emitted;
+	int emitted_boundary;
+	int emitted_capacity;
 	char user[1];
 };
 
@@ -80,20 +116,61 @@ struct gravm_runstack {
 	bool suspended;
 
 	stackframe_t *trash;
+	int n_trash;
 	stackframe_t *top;
 	int stack_size;
 	int max_stack_size;
 	int framedata_size; /* userdata per stackframe */
-	btree_t *edges;
+	gravm_program_t *program;
+	bool own_program; /* program has been compiled by gravm_runstack_prepare() */
+	int program_flags; /* passed to gravm_program_new() by gravm_runstack_prepare() */
+	int edge_payload_size;
+	int node_payload_size;
+	int options; /* GRAVM_RS_OPT_* */
+	uint64_t *visited; /* GRAVM_RS_OPT_VISIT_ONCE: one bit per node table entry */
+	int visited_words;
+	uint64_t *dirty; /* nodes marked by gravm_runstack_mark_dirty(), one bit per node table entry */
+	int dirty_words;
+	char *retained; /* GRAVM_RS_OPT_INCREMENTAL: last child frame produced by each edge, indexed like the program edges */
+	uint64_t *retained_valid; /* one bit per edge; cleared when the edge needs to be re-executed */
+	gravm_cache_t *cache;
+	char *level_frames; /* GRAVM_RS_OPT_LEVEL_ORDER: frames of all levels, one level after another, see level_frame() */
+	int n_level_frames;
+	int level_capacity;
+	size_t level_stride;
+	int *batch_ids; /* callback.node_run_batch/node_run_lanes arguments */
+	void **batch_frames;
+	int *batch_results;
+	int batch_capacity;
+	int *heap; /* GRAVM_RS_OPT_PRIORITY: ready frames, see heap_less() */
+	int n_heap;
+	int heap_capacity;
+	slot_reader_t *reader; /* prepared using gravm_runstack_prepare_slot() */
+	const uint64_t *edge_mask; /* enabled edge ids, see gravm_runstack_set_edge_mask(); NULL: all enabled */
+	uint64_t mask_key; /* part of the cache keys, unique per gravm_runstack_set_edge_mask() call; 0: no mask */
 
 	const gravm_runstack_callback_t *cb;
 
-	int root_lower;
-	int root_upper;
-
 	iterator_t root_it;
+	bool starting; /* gravm_runstack_run_from(): begin with the edges in 'start' instead of the root edges */
+	int *start; /* edge indices */
+	int n_start;
+	int start_capacity;
+	int start_pos; /* next entry of 'start' to be pushed */
+	void *start_parent; /* parent context of the start edges */
+	gravm_runstack_t **lanes; /* gravm_runstack_run_batch(): one runstack per user context, reused across batches */
+	int n_lanes;
+	gravm_runstack_callback_t lane_cb; /* callbacks of the lanes; like 'cb', but without destroy */
+	void **lane_users; /* callback.node_run_lanes arguments, one entry per lane */
+	bool parking; /* lane of a batch using callback.node_run_lanes: stop in front of node_run, see run_lanes() */
+	gravm_trace_t *trace; /* see gravm_runstack_set_trace(); NULL: disabled */
+	int lane_index; /* index of this lane, see gravm_runstack_run_batch(); -1: not a lane */
 	int throw_code;
+	bool throw_observed[GRAVM_RS_IP_POP + 1]; /* per ip: unwinding a frame from there reaches a catch or ascend callback */
 	bool invoked; /* has a callback been invoked? */
+	const edge_entry_t *cb_edge; /* set while invoking a callback on an outgoing edge of the current node */
+	int *ids; /* arguments of the bulk edge callbacks, see collect_ids() */
+	int ids_capacity;
 	void *user;
 };
 
@@ -161,6 +238,11 @@ static void throw_ascend(
 static void throw_pop(
 		gravm_runstack_t *self);
 
+static int run_levels(
+		gravm_runstack_t *self);
+static int run_priority(
+		gravm_runstack_t *self);
+
 static const char *ip_names[] = {
 	"descend",
 	"edge_begin",
@@ -227,74 +309,6 @@ static void (*step_throw[])(gravm_runstack_t*) = {
 	throw_pop
 };
 
-static int cmp_full(
-		const void *a_,
-		const void *b_)
-{
-	const edge_entry_t *a = a_;
-	const edge_entry_t *b = b_;
-	if(a->source < b->source)
-		return -1;
-	else if(a->source > b->source)
-		return 1;
-	else if(a->priority < b->priority)
-		return -1;
-	else if(a->priority > b->priority)
-		return 1;
-	else if(a->target < b->target)
-		return -1;
-	else if(a->target > b->target)
-		return 1;
-	else if(a->id < b->id)
-		return -1;
-	else if(a->id > b->id)
-		return 1;
-	else
-		return 0;
-}
-
-static int cmp_source(
-		const void *a_,
-		const void *b_)
-{
-	const edge_entry_t *a = a_;
-	const edge_entry_t *b = b_;
-	if(a->source < b->source)
-		return -1;
-	else if(a->source > b->source)
-		return 1;
-	else
-		return 0;
-}
-
-static int cmp_priority(
-		const void *a_,
-		const void *b_)
-{
-	const edge_entry_t *a = a_;
-	const edge_entry_t *b = b_;
-	if(a->source < b->source)
-		return -1;
-	else if(a->source > b->source)
-		return 1;
-	else if(a->priority < 0 && b->priority >= 0)
-		return -1;
-	else if(a->priority >= 0 && b->priority < 0)
-		return 1;
-	else
-		return 0;
-}
-
-static int cb_cmp(
-		btree_t *btree,
-		const void *a,
-		const void *b,
-		void *group)
-{
-	int (*cmp)(const void*, const void*) = group;
-	return cmp(a, b);
-}
-
 static void pop(
 		gravm_runstack_t *self)
 {
@@ -307,14 +321,18 @@ static void pop(
 	self->top = self->top->prev;
 	top->prev = self->trash;
 	self->trash = top;
+	self->n_trash++;
 	self->stack_size--;
 }
 
 static int push(
 		gravm_runstack_t *self,
-		edge_entry_t *edge)
+		const edge_entry_t *edge,
+		gravm_program_t *program)
 {
 	stackframe_t *top;
+	edge_entry_t *emitted_edges;
+	int emitted_capacity;
 
 	if(self->max_stack_size >= 0 && self->stack_size == self->max_stack_size)
 		return -EOVERFLOW;
@@ -322,108 +340,213 @@ static int push(
 		self->trash = calloc(1, sizeof(stackframe_t) + self->framedata_size - 1);
 		if(self->trash == NULL)
 			return -ENOMEM;
+		self->n_trash++;
 	}
 	top = self->top;
 	self->top = self->trash;
 	self->trash = self->top->prev;
+	self->n_trash--;
+	emitted_edges = self->top->emitted_edges;
+	emitted_capacity = self->top->emitted_capacity;
 	memset(self->top, 0, sizeof(stackframe_t) + self->framedata_size - 1);
+	self->top->emitted_edges = emitted_edges;
+	self->top->emitted_capacity = emitted_capacity;
 	self->top->prev = top;
 	self->top->iteration = -1;
 	self->top->ip = GRAVM_RS_IP_DESCEND;
+	self->top->program = program;
 	self->top->edge = edge;
+	self->top->out = program_node(program, edge->target);
+	program_touch(program, edge->target);
 	self->stack_size++;
 	return 0;
 }
 
+static inline bool mask_test(
+		const uint64_t *mask,
+		int id)
+{
+	return (mask[id / 64] & ((uint64_t)1 << (id % 64))) != 0;
+}
+
+/* moves the iterator forward to the next enabled edge, starting with the current one */
+static bool it_skip(
+		iterator_t *it)
+{
+	const edge_entry_t *edge;
+
+	if(it->mask == NULL)
+		return true;
+	while(true) {
+		edge = program_edge(it->program, it->index);
+		if(mask_test(it->mask, edge->id))
+			return true;
+		else if(++it->index == it->upper)
+			return false;
+	}
+}
+
 static bool it_begin(
-		btree_t *btree,
 		iterator_t *it,
+		gravm_program_t *program,
 		int lower,
 		int upper)
 {
-#ifdef DEBUG
-	int ret;
-#endif
-
 	if(lower < 0)
 		return false;
 	else if(lower >= upper)
 		return false;
 	it->lower = lower;
 	it->upper = upper;
+	it->index = lower;
+	it->program = program;
+	it->mask = NULL;
+	it->emitted = NULL;
+	return true;
+}
 
-#ifndef DEBUG
-	/* this must work if there is no bug since index must have been retrieved previously from same tree */
-	btree_find_at(btree, lower, &it->it);
-#else
-	ret = btree_find_at(btree, lower, &it->it);
-	assert(ret >= 0);
-#endif
+/* like it_begin(), but it_begin_enabled() and it_next() skip edges disabled by the current edge mask unless 'called'.
+ * the mask refers to the runstack's own execution of its program, so it does not apply below a call, not even if the
+ * called program is the runstack's one */
+static bool it_begin_enabled(
+		gravm_runstack_t *self,
+		iterator_t *it,
+		gravm_program_t *program,
+		bool called,
+		int lower,
+		int upper)
+{
+	if(!it_begin(it, program, lower, upper))
+		return false;
+	if(!called)
+		it->mask = self->edge_mask;
+	return it_skip(it);
+}
+
+/* iterates over the edges emitted by the node of the top frame, see gravm_runstack_emit(). their ids are chosen by
+ * the caller and need not be covered by the edge mask, so the mask does not apply */
+static bool it_begin_emitted(
+		gravm_runstack_t *self,
+		iterator_t *it,
+		int lower,
+		int upper)
+{
+	if(!it_begin(it, self->top->program, lower, upper))
+		return false;
+	it->emitted = self->top->emitted_edges;
 	return true;
 }
 
 static bool it_end(
-		btree_t *btree,
 		iterator_t *it,
+		gravm_program_t *program,
 		int upper,
 		int lower)
 {
-#ifdef DEBUG
-	int ret;
-#endif
-
 	if(upper <= 0)
 		return false;
 	else if(lower >= upper)
 		return false;
 	it->upper = upper;
 	it->lower = lower;
-
-#ifndef DEBUG
-	/* this must work if there is no bug since index must have been retrieved previously from same tree */
-	btree_find_at(btree, upper - 1, &it->it);
-#else
-	ret = btree_find_at(btree, upper - 1, &it->it);
-	assert(ret >= 0);
-#endif
+	it->index = upper - 1;
+	it->program = program;
+	it->mask = NULL;
+	it->emitted = NULL;
 	return true;
 }
 
 static bool it_next(
 		iterator_t *it)
 {
-#ifdef DEBUG
-	int ret;
-#endif
-
-#ifndef DEBUG
-	btree_iterate_next(&it->it);
-#else
-	ret = btree_iterate_next(&it->it);
-	assert(ret >= 0);
-#endif
-	if(it->it.index == it->upper)
+	it->index++;
+	if(it->index == it->upper)
 		return false;
 
-	return true;
+	return it_skip(it);
 }
 
 static bool it_prev(
 		iterator_t *it)
 {
-#ifdef DEBUG
+	if(it->index == it->lower)
+		return false;
+
+	it->index--;
+	return true;
+}
+
+static inline bool edge_enabled(
+		gravm_runstack_t *self,
+		const edge_entry_t *edge)
+{
+	return self->edge_mask == NULL || mask_test(self->edge_mask, edge->id);
+}
+
+static inline const edge_entry_t *it_element(
+		gravm_runstack_t *self,
+		const iterator_t *it)
+{
+	if(it->emitted != NULL)
+		return it->emitted + it->index;
+	return program_edge(it->program, it->index);
+}
+
+/* whether the frame's edge is an edge of the runstack's program, i.e. neither emitted nor below a call */
+static inline bool own_edge(
+		gravm_runstack_t *self,
+		const stackframe_t *frame)
+{
+	return !frame->emitted && !frame->called;
+}
+
+/* context of the parent frame; NULL for root edges, the caller-supplied context for gravm_runstack_run_from() */
+static void *parent_context(
+		gravm_runstack_t *self)
+{
+	if(self->top->prev != NULL)
+		return self->top->prev->user;
+	else
+		return self->start_parent;
+}
+
+/* returns GRAVM_RS_TRUE if the child frame has been taken from the cache */
+static int cache_fetch(
+		gravm_runstack_t *self)
+{
 	int ret;
-#endif
 
-	if(it->it.index == it->lower)
-		return false;
+	if(self->cache == NULL || self->cb->fingerprint == NULL || self->top->prev == NULL || !own_edge(self, self->top))
+		return GRAVM_RS_FALSE;
+	ret = self->cb->fingerprint(self->user, self->top->edge->id, self->top->prev->user, &self->top->fingerprint);
+	self->invoked = true;
+	if(ret != GRAVM_RS_TRUE)
+		return ret;
+	if(cache_lookup(self->cache, self->program->identity, self->mask_key, self->top->edge->id, self->top->fingerprint, self->top->user, self->framedata_size))
+		return GRAVM_RS_TRUE;
+	self->top->cache_store = true;
+	return GRAVM_RS_FALSE;
+}
 
-#ifndef DEBUG
-	btree_iterate_prev(&it->it);
-#else
-	ret = btree_iterate_prev(&it->it);
-	assert(ret >= 0);
-#endif
+static int edge_index(
+		gravm_runstack_t *self,
+		const edge_entry_t *edge)
+{
+	return ((const char*)edge - self->program->edges) / self->program->edge_stride;
+}
+
+/* GRAVM_RS_OPT_INCREMENTAL: returns true if the child frame has been taken from the previous execution of the edge */
+static bool reuse_retained(
+		gravm_runstack_t *self)
+{
+	int index = edge_index(self, self->top->edge);
+	uint64_t bit = (uint64_t)1 << (index % 64);
+
+	if((self->retained_valid[index / 64] & bit) == 0) {
+		self->top->retain = true;
+		return false;
+	}
+	memcpy(self->top->user, self->retained + (size_t)index * self->framedata_size, self->framedata_size);
 	return true;
 }
 
@@ -431,26 +554,27 @@ static void exec_descend(
 		gravm_runstack_t *self)
 {
 	int ret;
-	
-	if(self->cb->descend != NULL) {
-		void *user;
-		if(self->top->prev == NULL)
-			user = self->top->prev->user;
-		else
-			user = NULL;
-		ret = self->cb->descend(self->user, self->top->edge->id, user, self->top->user);
-		self->invoked = true;
+
+	if((self->options & GRAVM_RS_OPT_INCREMENTAL) != 0 && own_edge(self, self->top) && reuse_retained(self)) {
+		self->top->ip = GRAVM_RS_IP_ASCEND;
+		return;
+	}
+	ret = cache_fetch(self);
+	switch(ret) {
+		case GRAVM_RS_TRUE: /* hand the cached child frame to ascend() without executing the subgraph */
+			self->top->ip = GRAVM_RS_IP_ASCEND;
+			return;
+		case GRAVM_RS_FALSE:
+			break;
+		EXEC_EXCEPTION_CASES
 	}
-	else
-		ret = GRAVM_RS_TRUE;
 
-	
-/*	if(self->top->prev != NULL && self->cb->descend != NULL) {
-		ret = self->cb->descend(self->user, self->top->edge->id, self->top->prev->user, self->top->user);
+	if(self->cb->descend != NULL) {
+		ret = self->cb->descend(self->user, self->top->edge->id, parent_context(self), self->top->user);
 		self->invoked = true;
 	}
 	else
-		ret = GRAVM_RS_TRUE;*/
+		ret = GRAVM_RS_TRUE;
 
 	switch(ret) {
 		case GRAVM_RS_TRUE:
@@ -513,11 +637,50 @@ static void exec_edge_next(
 	}
 }
 
+/* marks the node as visited; returns whether it has been visited before */
+static bool visit(
+		gravm_runstack_t *self,
+		int node)
+{
+	int index = node + 1;
+	uint64_t bit = (uint64_t)1 << (index % 64);
+	bool visited = (self->visited[index / 64] & bit) != 0;
+
+	self->visited[index / 64] |= bit;
+	return visited;
+}
+
+static void exec_node_revisit(
+		gravm_runstack_t *self)
+{
+	int ret;
+
+	if(self->cb->node_revisit != NULL) {
+		ret = self->cb->node_revisit(self->user, self->top->edge->target, self->top->user);
+		self->invoked = true;
+	}
+	else
+		ret = GRAVM_RS_SUCCESS;
+
+	switch(ret) {
+		case GRAVM_RS_SUCCESS:
+			self->top->ip = GRAVM_RS_IP_EDGE_END;
+			return;
+		EXEC_EXCEPTION_CASES
+	}
+}
+
 static void exec_node_enter(
 		gravm_runstack_t *self)
 {
 	int ret;
 
+	if((self->options & GRAVM_RS_OPT_VISIT_ONCE) != 0 && !self->top->called && visit(self, self->top->edge->target)) {
+		exec_node_revisit(self);
+		return;
+	}
+	self->top->n_emitted = 0;
+	self->top->emitted_boundary = 0;
 	if(self->cb->node_enter != NULL) {
 		ret = self->cb->node_enter(self->user, self->top->edge->target, self->top->user);
 		self->invoked = true;
@@ -536,11 +699,47 @@ static void exec_node_enter(
 	}
 }
 
+/* ids of the edges [lower, upper) for the bulk edge callbacks; NULL if out of memory */
+static const int *collect_ids(
+		gravm_runstack_t *self,
+		const gravm_program_t *program,
+		int lower,
+		int upper)
+{
+	int *ids;
+	int i;
+
+	if(upper - lower > self->ids_capacity) {
+		ids = realloc(self->ids, sizeof(int) * (upper - lower));
+		if(ids == NULL)
+			return NULL;
+		self->ids = ids;
+		self->ids_capacity = upper - lower;
+	}
+	for(i = lower; i < upper; i++)
+		self->ids[i - lower] = program_edge(program, i)->id;
+	return self->ids;
+}
+
+static inline bool aborts_edges(
+		gravm_runstack_t *self)
+{
+	return self->cb->edge_abort != NULL || self->cb->edges_abort != NULL;
+}
+
+static inline bool lazy_prepare(
+		gravm_runstack_t *self)
+{
+	return (self->options & GRAVM_RS_OPT_LAZY_PREPARE) != 0;
+}
+
 static void exec_begin_edge_prepare(
 		gravm_runstack_t *self)
 {
-	if(self->cb->edge_prepare != NULL && it_begin(self->edges, &self->top->out_it, self->top->edge->out_lower, self->top->edge->out_upper)) {
-		self->top->out_cur = self->top->out_it.it.element;
+	if(lazy_prepare(self))
+		self->top->ip = GRAVM_RS_IP_BEGIN_OUTGOING_PRE;
+	else if((self->cb->edge_prepare != NULL || self->cb->edges_prepare != NULL) && it_begin(&self->top->out_it, self->top->program, self->top->out->lower, self->top->out->upper)) {
+		self->top->out_cur = it_element(self, &self->top->out_it);
 		self->top->ip++;
 	}
 	else
@@ -550,16 +749,35 @@ static void exec_begin_edge_prepare(
 static void exec_loop_edge_prepare(
 		gravm_runstack_t *self)
 {
+	const int *ids;
 	int ret;
 
+	if(self->cb->edges_prepare != NULL) { /* out_it stays at the first edge, so nothing is aborted when throwing */
+		ids = collect_ids(self, self->top->program, self->top->out->lower, self->top->out->upper);
+		if(ids == NULL) {
+			errno = -ENOMEM;
+			self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
+			return;
+		}
+		ret = self->cb->edges_prepare(self->user, self->top->out->upper - self->top->out->lower, ids, self->top->user);
+		self->invoked = true;
+		switch(ret) {
+			case GRAVM_RS_SUCCESS:
+				self->top->ip++;
+				return;
+			EXEC_EXCEPTION_CASES
+		}
+	}
 	assert(self->cb->edge_prepare != NULL);
 	assert(self->top->out_cur != NULL);
+	self->cb_edge = self->top->out_cur;
 	ret = self->cb->edge_prepare(self->user, self->top->out_cur->id, self->top->user);
+	self->cb_edge = NULL;
 	self->invoked = true;
 	switch(ret) {
 		case GRAVM_RS_SUCCESS:
 			if(it_next(&self->top->out_it))
-				self->top->out_cur = self->top->out_it.it.element;
+				self->top->out_cur = it_element(self, &self->top->out_it);
 			else
 				self->top->ip++;
 			return;
@@ -567,43 +785,155 @@ static void exec_loop_edge_prepare(
 	}
 }
 
+/* begins iterating over the pre (out_nextip == GRAVM_RS_IP_NODE_RUN) or post edges of the first kind starting at
+ * 'phase' which has any. returns false if there are none left */
+static bool begin_outgoing(
+		gravm_runstack_t *self,
+		int phase)
+{
+	stackframe_t *top = self->top;
+	bool pre = top->out_nextip == GRAVM_RS_IP_NODE_RUN;
+	gravm_program_t *callee;
+	const range_t *root;
+
+	for(; phase < OUT_DONE; phase++) {
+		top->out_phase = phase;
+		switch(phase) {
+			case OUT_PROGRAM:
+				if(it_begin_enabled(self, &top->out_it, top->program, top->called, pre ? top->out->lower : top->out->boundary, pre ? top->out->boundary : top->out->upper))
+					return true;
+				break;
+			case OUT_EMITTED:
+				if(it_begin_emitted(self, &top->out_it, pre ? 0 : top->emitted_boundary, pre ? top->emitted_boundary : top->n_emitted))
+					return true;
+				break;
+			case OUT_CALLEE:
+				callee = program_callee(top->program, top->edge->target);
+				if(pre || callee == NULL)
+					break;
+				root = program_node(callee, GRAVM_RS_ROOT);
+				if(it_begin_enabled(self, &top->out_it, callee, true, root->lower, root->upper))
+					return true;
+				break;
+		}
+	}
+	return false;
+}
+
 static void exec_begin_outgoing_pre(
 		gravm_runstack_t *self)
 {
-	if(it_begin(self->edges, &self->top->out_it, self->top->edge->out_lower, self->top->edge->out_boundary)) {
-		self->top->out_cur = self->top->out_it.it.element;
-		self->top->out_upper = self->top->edge->out_boundary;
-		self->top->out_nextip = GRAVM_RS_IP_NODE_RUN;
+	self->top->out_upper = self->top->out->boundary;
+	self->top->out_nextip = GRAVM_RS_IP_NODE_RUN;
+	if(begin_outgoing(self, OUT_PROGRAM)) {
+		self->top->out_cur = it_element(self, &self->top->out_it);
 		self->top->ip++;
 	}
 	else
 		self->top->ip = GRAVM_RS_IP_NODE_RUN;
 }
 
-static void exec_loop_outgoing_pre(
+/* GRAVM_RS_OPT_LAZY_PREPARE: prepares out_cur right before it is pushed */
+static int prepare_lazily(
+		gravm_runstack_t *self)
+{
+	int ret = GRAVM_RS_SUCCESS;
+
+	self->cb_edge = self->top->out_cur;
+	if(self->cb->edges_prepare != NULL) {
+		ret = self->cb->edges_prepare(self->user, 1, &self->top->out_cur->id, self->top->user);
+		self->invoked = true;
+	}
+	else if(self->cb->edge_prepare != NULL) {
+		ret = self->cb->edge_prepare(self->user, self->top->out_cur->id, self->top->user);
+		self->invoked = true;
+	}
+	self->cb_edge = NULL;
+	return ret;
+}
+
+/* GRAVM_RS_OPT_LAZY_PREPARE: unprepares out_cur right after it has been popped */
+static int unprepare_lazily(
+		gravm_runstack_t *self)
+{
+	int ret = GRAVM_RS_SUCCESS;
+
+	self->cb_edge = self->top->out_cur;
+	if(self->cb->edges_unprepare != NULL) {
+		ret = self->cb->edges_unprepare(self->user, 1, &self->top->out_cur->id, self->top->user);
+		self->invoked = true;
+	}
+	else if(self->cb->edge_unprepare != NULL) {
+		ret = self->cb->edge_unprepare(self->user, self->top->out_cur->id, self->top->user);
+		self->invoked = true;
+	}
+	self->cb_edge = NULL;
+	return ret;
+}
+
+/* continues with the next kind of outgoing edges once those of the current one are done */
+static void next_outgoing(
+		gravm_runstack_t *self)
+{
+	stackframe_t *top = self->top;
+
+	if(it_next(&top->out_it) || begin_outgoing(self, top->out_phase + 1))
+		top->out_cur = it_element(self, &top->out_it);
+	else
+		top->ip = top->out_nextip;
+}
+
+/* pushes out_cur, the iterator is advanced by exec_pop(). GRAVM_RS_OPT_LAZY_PREPARE: prepares out_cur before
+ * pushing it; as out_prepared is still set after popping, this is called once more to unprepare and advance */
+static void loop_outgoing(
 		gravm_runstack_t *self)
 {
 	int ret;
-	
+
 	assert(self->top->out_cur != NULL);
 
-	ret = push(self, self->top->out_cur);
+	if(lazy_prepare(self) && self->top->out_phase == OUT_PROGRAM) { /* emitted and called edges are never prepared */
+		if(self->top->out_prepared) {
+			self->top->out_prepared = false;
+			ret = unprepare_lazily(self);
+			switch(ret) {
+				case GRAVM_RS_SUCCESS:
+					next_outgoing(self);
+					return;
+				EXEC_EXCEPTION_CASES
+			}
+		}
+		ret = prepare_lazily(self);
+		switch(ret) {
+			case GRAVM_RS_SUCCESS:
+				self->top->out_prepared = true;
+				break;
+			EXEC_EXCEPTION_CASES
+		}
+	}
+
+	ret = push(self, self->top->out_cur, self->top->out_it.program);
 	if(ret < 0) {
 		errno = ret;
 		self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
 	}
+	else {
+		self->top->emitted = self->top->prev->out_phase == OUT_EMITTED;
+		self->top->called = self->top->prev->called || self->top->prev->out_phase == OUT_CALLEE;
+	}
 }
 
-static void exec_node_run(
+static void exec_loop_outgoing_pre(
 		gravm_runstack_t *self)
 {
-	int ret;
-	if(self->cb->node_run != NULL) {
-		ret = self->cb->node_run(self->user, self->top->edge->target, self->top->user);
-		self->invoked = true;
-	}
-	else
-		ret = GRAVM_RS_TRUE;
+	loop_outgoing(self);
+}
+
+/* continues after node_run returned 'ret'; also used for the lanes of a batch, see run_lanes() */
+static void node_run_done(
+		gravm_runstack_t *self,
+		int ret)
+{
 	switch(ret) {
 		case GRAVM_RS_TRUE:
 			self->top->ip++;
@@ -615,13 +945,26 @@ static void exec_node_run(
 	}
 }
 
+static void exec_node_run(
+		gravm_runstack_t *self)
+{
+	int ret;
+	if(self->cb->node_run != NULL) {
+		ret = self->cb->node_run(self->user, self->top->edge->target, self->top->user);
+		self->invoked = true;
+	}
+	else
+		ret = GRAVM_RS_TRUE;
+	node_run_done(self, ret);
+}
+
 static void exec_begin_outgoing_post(
 		gravm_runstack_t *self)
 {
-	if(it_begin(self->edges, &self->top->out_it, self->top->edge->out_boundary, self->top->edge->out_upper)) {
-		self->top->out_cur = self->top->out_it.it.element;
-		self->top->out_upper = self->top->edge->out_upper;
-		self->top->out_nextip = GRAVM_RS_IP_BEGIN_EDGE_UNPREPARE;
+	self->top->out_upper = self->top->out->upper;
+	self->top->out_nextip = GRAVM_RS_IP_BEGIN_EDGE_UNPREPARE;
+	if(begin_outgoing(self, OUT_PROGRAM)) {
+		self->top->out_cur = it_element(self, &self->top->out_it);
 		self->top->ip++;
 	}
 	else
@@ -631,22 +974,16 @@ static void exec_begin_outgoing_post(
 static void exec_loop_outgoing_post(
 		gravm_runstack_t *self)
 {
-	int ret;
-	
-	assert(self->top->out_cur != NULL);
-
-	ret = push(self, self->top->out_cur);
-	if(ret < 0) {
-		errno = ret;
-		self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
-	}
+	loop_outgoing(self);
 }
 
 static void exec_begin_edge_unprepare(
 		gravm_runstack_t *self)
 {
-	if(self->cb->edge_unprepare != NULL && it_end(self->edges, &self->top->out_it, self->top->edge->out_upper, self->top->edge->out_lower)) {
-		self->top->out_cur = self->top->out_it.it.element;
+	if(lazy_prepare(self)) /* nothing prepared anymore */
+		self->top->ip = GRAVM_RS_IP_NODE_LEAVE;
+	else if((self->cb->edge_unprepare != NULL || self->cb->edges_unprepare != NULL) && it_end(&self->top->out_it, self->top->program, self->top->out->upper, self->top->out->lower)) {
+		self->top->out_cur = it_element(self, &self->top->out_it);
 		self->top->ip++;
 	}
 	else
@@ -656,16 +993,36 @@ static void exec_begin_edge_unprepare(
 static void exec_loop_edge_unprepare(
 		gravm_runstack_t *self)
 {
+	const int *ids;
 	int ret;
 
+	if(self->cb->edges_unprepare != NULL) {
+		ids = collect_ids(self, self->top->program, self->top->out->lower, self->top->out->upper);
+		if(ids == NULL) {
+			errno = -ENOMEM;
+			self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
+			return;
+		}
+		self->top->out_it.index = self->top->out_it.lower; /* nothing left to abort when throwing */
+		ret = self->cb->edges_unprepare(self->user, self->top->out->upper - self->top->out->lower, ids, self->top->user);
+		self->invoked = true;
+		switch(ret) {
+			case GRAVM_RS_SUCCESS:
+				self->top->ip++;
+				return;
+			EXEC_EXCEPTION_CASES
+		}
+	}
 	assert(self->cb->edge_unprepare != NULL);
 	assert(self->top->out_cur != NULL);
+	self->cb_edge = self->top->out_cur;
 	ret = self->cb->edge_unprepare(self->user, self->top->out_cur->id, self->top->user);
+	self->cb_edge = NULL;
 	self->invoked = true;
 	switch(ret) {
 		case GRAVM_RS_SUCCESS:
 			if(it_prev(&self->top->out_it))
-				self->top->out_cur = self->top->out_it.it.element;
+				self->top->out_cur = it_element(self, &self->top->out_it);
 			else
 				self->top->ip++;
 			return;
@@ -714,26 +1071,30 @@ static void exec_edge_end(
 static void exec_ascend(
 		gravm_runstack_t *self)
 {
+	int index;
 	int ret;
+
+	if(self->top->cache_store) {
+		ret = cache_store(self->cache, self->program->identity, self->mask_key, self->top->edge->id, self->top->fingerprint, self->top->user, self->framedata_size);
+		if(ret < 0 && ret != -E2BIG) {
+			errno = ret;
+			self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
+			return;
+		}
+		self->top->cache_store = false;
+	}
+	if(self->top->retain) {
+		index = edge_index(self, self->top->edge);
+		memcpy(self->retained + (size_t)index * self->framedata_size, self->top->user, self->framedata_size);
+		self->retained_valid[index / 64] |= (uint64_t)1 << (index % 64);
+		self->top->retain = false;
+	}
 	if(self->cb->ascend != NULL) {
-		void *user;
-		if(self->top->prev == NULL)
-			user = self->top->prev->user;
-		else
-			user = NULL;
-		ret = self->cb->ascend(self->user, self->top->edge->id, false, 0, user, self->top->user);
+		ret = self->cb->ascend(self->user, self->top->edge->id, false, 0, parent_context(self), self->top->user);
 		self->invoked = true;
 	}
 	else
 		ret = GRAVM_RS_SUCCESS;
-
-
-/*	if(self->cb->ascend != NULL) {
-		ret = self->cb->ascend(self->user, self->top->edge->id, false, 0, self->top->prev->user, self->top->user);
-		self->invoked = true;
-	}
-	else
-		ret = GRAVM_RS_SUCCESS;*/
 	switch(ret) {
 		case GRAVM_RS_SUCCESS:
 			self->top->ip++;
@@ -746,12 +1107,8 @@ static void exec_pop(
 		gravm_runstack_t *self)
 {
 	pop(self);
-	if(self->top != NULL) {
-		if(it_next(&self->top->out_it))
-			self->top->out_cur = self->top->out_it.it.element;
-		else
-			self->top->ip = self->top->out_nextip;
-	}
+	if(self->top != NULL && !self->top->out_prepared)
+		next_outgoing(self);
 }
 
 static void throw_descend(
@@ -781,8 +1138,8 @@ static void throw_node_enter(
 static void throw_loop_edge_prepare(
 		gravm_runstack_t *self)
 {
-	if(self->cb->edge_abort != NULL && it_prev(&self->top->out_it)) /* previously prepared edges for which abort() needs to be called? */
-		self->top->out_cur = self->top->out_it.it.element;
+	if(aborts_edges(self) && it_prev(&self->top->out_it)) /* previously prepared edges for which abort() needs to be called? */
+		self->top->out_cur = it_element(self, &self->top->out_it);
 	else
 		self->top->out_cur = NULL;
 	self->top->ip = GRAVM_RS_IP_BEGIN_EDGE_UNPREPARE;
@@ -797,288 +1154,1624 @@ static void throw_loop_outgoing_pre(
 static void throw_node_run(
 		gravm_runstack_t *self)
 {
-	self->top->ip = GRAVM_RS_IP_LOOP_OUTGOING_POST;
-}
+	self->top->ip = GRAVM_RS_IP_LOOP_OUTGOING_POST;
+}
+
+static void throw_loop_outgoing_post(
+		gravm_runstack_t *self)
+{
+	if(lazy_prepare(self)) { /* only out_cur may be prepared */
+		if(aborts_edges(self) && self->top->out_prepared)
+			self->top->out_it.lower = self->top->out_it.index;
+		else
+			self->top->out_cur = NULL;
+		self->top->out_prepared = false;
+	}
+	else if(aborts_edges(self) && it_end(&self->top->out_it, self->top->program, self->top->out->upper, self->top->out->lower))
+		self->top->out_cur = it_element(self, &self->top->out_it);
+	else
+		self->top->out_cur = NULL;
+	self->top->ip = GRAVM_RS_IP_BEGIN_EDGE_UNPREPARE;
+}
+
+static void throw_begin_edge_unprepare(
+		gravm_runstack_t *self)
+{
+	const int *ids;
+	int ret;
+
+	if(self->top->out_cur != NULL && self->cb->edges_abort != NULL) { /* all remaining prepared edges at once */
+		ids = collect_ids(self, self->top->program, self->top->out_it.lower, self->top->out_it.index + 1);
+		if(ids == NULL) {
+			errno = -ENOMEM;
+			self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
+			return;
+		}
+		ret = self->cb->edges_abort(self->user, self->throw_code, self->top->out_it.index + 1 - self->top->out_it.lower, ids, self->top->user);
+		self->invoked = true;
+		self->top->out_cur = NULL;
+		switch(ret) {
+			case GRAVM_RS_SUCCESS:
+				return;
+			THROW_EXCEPTION_CASES
+		}
+	}
+	else if(self->top->out_cur != NULL) { /* prepared edges remaining, abort them */
+		assert(self->cb->edge_abort != NULL);
+		self->cb_edge = self->top->out_cur;
+		ret = self->cb->edge_abort(self->user, self->throw_code, self->top->out_cur->id, self->top->user);
+		self->cb_edge = NULL;
+		self->invoked = true;
+		if(it_prev(&self->top->out_it))
+			self->top->out_cur = it_element(self, &self->top->out_it);
+		else
+			self->top->out_cur = NULL;
+		switch(ret) {
+			case GRAVM_RS_SUCCESS:
+				return;
+			THROW_EXCEPTION_CASES
+		}
+	}
+	else { /* no prepared edges remaining, call node_catch */
+		if(self->cb->node_catch != NULL) {
+			ret = self->cb->node_catch(self->user, self->throw_code, self->top->edge->target, self->top->user);
+			self->invoked = true;
+		}
+		else
+			ret = GRAVM_RS_FALSE;
+		switch(ret) {
+			case GRAVM_RS_FALSE:
+				self->top->ip = GRAVM_RS_IP_NODE_LEAVE;
+				return;
+			case GRAVM_RS_TRUE:
+				self->top->ip = GRAVM_RS_IP_EDGE_END;
+				self->state = GRAVM_RS_STATE_EXECUTING;
+				return;
+			case GRAVM_RS_THROW:
+				self->throw_code = errno;
+				self->top->ip = GRAVM_RS_IP_NODE_LEAVE;
+				return;
+			THROW_FATAL_CASES
+		}
+	}
+}
+
+static void throw_loop_edge_unprepare(
+		gravm_runstack_t *self)
+{
+	if(aborts_edges(self) && it_prev(&self->top->out_it))
+		self->top->out_cur = it_element(self, &self->top->out_it);
+	else
+		self->top->out_cur = NULL;
+	self->top->ip = GRAVM_RS_IP_BEGIN_EDGE_UNPREPARE;
+}
+
+static void throw_node_leave(
+		gravm_runstack_t *self)
+{
+	int ret;
+
+	if(self->cb->edge_catch != NULL) {
+		ret = self->cb->edge_catch(self->user, self->throw_code, self->top->edge->id, self->top->user);
+		self->invoked = true;
+	}
+	else
+		ret = GRAVM_RS_FALSE;
+	switch(ret) {
+		case GRAVM_RS_FALSE:
+			self->top->ip++;
+			return;
+		case GRAVM_RS_TRUE:
+			self->top->ip = GRAVM_RS_IP_EDGE_NEXT;
+			self->state = GRAVM_RS_STATE_EXECUTING;
+			return;
+		case GRAVM_RS_THROW:
+			self->throw_code = errno;
+			self->top->ip++;
+			return;
+		THROW_FATAL_CASES
+	}
+}
+
+static void throw_edge_end(
+		gravm_runstack_t *self)
+{
+	int ret;
+
+	if(self->cb->ascend != NULL) {
+		ret = self->cb->ascend(self->user, self->top->edge->id, true, self->throw_code, parent_context(self), self->top->user);
+		self->invoked = true;
+	}
+	else
+		ret = GRAVM_RS_SUCCESS;
+	switch(ret) {
+		case GRAVM_RS_SUCCESS:
+			self->top->ip++;
+			return;
+		THROW_EXCEPTION_CASES
+	}
+	pop(self);
+}
+
+static void throw_ascend(
+		gravm_runstack_t *self)
+{
+	pop(self);
+}
+
+static void throw_pop(
+		gravm_runstack_t *self)
+{
+	pop(self);
+}
+
+/* the program changed, so edge indices and node ids may refer to something else now */
+static void drop_retained(
+		gravm_runstack_t *self)
+{
+	if(self->retained == NULL) /* nothing to drop; the dirty nodes do not matter until something is retained again */
+		return;
+	free(self->retained);
+	free(self->retained_valid);
+	self->retained = NULL;
+	self->retained_valid = NULL;
+	if(self->dirty != NULL)
+		memset(self->dirty, 0, sizeof(uint64_t) * self->dirty_words);
+}
+
+/* the program changed, so everything referring to edge indices is stale */
+static void program_changed(
+		gravm_runstack_t *self)
+{
+	drop_retained(self);
+	self->starting = false;
+	self->start_parent = NULL;
+}
+
+/* fills throw_observed[] according to the registered callbacks, following the transitions of step_throw[]:
+ * node_catch is reached from the outgoing edge loop only, edge_catch additionally from edge_next, node_enter and
+ * node_leave, ascend from everywhere up to edge_end. descend, ascend and pop just pop the frame */
+static void init_throw_observed(
+		gravm_runstack_t *self)
+{
+	bool ascend = self->cb->ascend != NULL;
+	bool edge_catch = ascend || self->cb->edge_catch != NULL;
+	bool node_catch = edge_catch || self->cb->node_catch != NULL;
+	int ip;
+
+	for(ip = 0; ip <= GRAVM_RS_IP_POP; ip++) {
+		if(ip == GRAVM_RS_IP_EDGE_BEGIN || ip == GRAVM_RS_IP_EDGE_END)
+			self->throw_observed[ip] = ascend;
+		else if(ip == GRAVM_RS_IP_EDGE_NEXT || ip == GRAVM_RS_IP_NODE_ENTER || ip == GRAVM_RS_IP_NODE_LEAVE)
+			self->throw_observed[ip] = edge_catch;
+		else if(ip >= GRAVM_RS_IP_LOOP_EDGE_PREPARE && ip <= GRAVM_RS_IP_LOOP_EDGE_UNPREPARE)
+			self->throw_observed[ip] = node_catch;
+		else
+			self->throw_observed[ip] = false;
+	}
+}
+
+/* whether unwinding the frame may invoke a callback. frames which do not are popped right away instead of being
+ * walked through step_throw[] */
+static bool observes_throw(
+		gravm_runstack_t *self,
+		stackframe_t *frame)
+{
+	if(self->throw_observed[frame->ip])
+		return true;
+	else if(aborts_edges(self)) /* prepared outgoing edges need to be aborted */
+		return frame->ip >= GRAVM_RS_IP_LOOP_EDGE_PREPARE && frame->ip <= GRAVM_RS_IP_LOOP_EDGE_UNPREPARE && frame->out->lower < frame->out->upper;
+	else
+		return false;
+}
+
+static void release_program(
+		gravm_runstack_t *self)
+{
+	if(self->program != NULL && self->own_program)
+		gravm_program_destroy(self->program);
+	if(self->reader != NULL) {
+		slot_unpin(self->reader);
+		slot_unregister(self->reader);
+		self->reader = NULL;
+	}
+	self->program = NULL;
+	self->own_program = false;
+	program_changed(self);
+}
+
+/* GRAVM_RS_OPT_PREALLOCATE: allocates as many frames as the program may need, so push() does not need to */
+static int preallocate(
+		gravm_runstack_t *self)
+{
+	stackframe_t *frame;
+	int depth;
+
+	if((self->options & GRAVM_RS_OPT_PREALLOCATE) == 0)
+		return 0;
+	depth = program_depth(self->program);
+	if(depth == -ELOOP) /* unknown, frames are allocated on demand */
+		return 0;
+	else if(depth < 0)
+		return depth;
+	if(self->max_stack_size >= 0 && depth > self->max_stack_size)
+		depth = self->max_stack_size;
+	while(self->n_trash + self->stack_size < depth) {
+		frame = calloc(1, sizeof(stackframe_t) + self->framedata_size - 1);
+		if(frame == NULL)
+			return -ENOMEM;
+		frame->prev = self->trash;
+		self->trash = frame;
+		self->n_trash++;
+	}
+	return 0;
+}
+
+gravm_runstack_t *gravm_runstack_new(
+		const gravm_runstack_callback_t *cb,
+		int max_stack_size,
+		int framedata_size)
+{
+	return gravm_runstack_new_payload(cb, max_stack_size, framedata_size, 0, 0);
+}
+
+gravm_runstack_t *gravm_runstack_new_payload(
+		const gravm_runstack_callback_t *cb,
+		int max_stack_size,
+		int framedata_size,
+		int edge_payload_size,
+		int node_payload_size)
+{
+	gravm_runstack_t *rs;
+
+	if(edge_payload_size < 0 || node_payload_size < 0) {
+		errno = -EINVAL;
+		return NULL;
+	}
+	rs = calloc(1, sizeof(*rs));
+	if(rs == NULL) {
+		errno = -ENOMEM;
+		return NULL;
+	}
+
+	rs->framedata_size = framedata_size;
+	rs->cb = cb;
+	rs->max_stack_size = max_stack_size;
+	rs->edge_payload_size = edge_payload_size;
+	rs->node_payload_size = node_payload_size;
+	rs->state = GRAVM_RS_STATE_CREATED;
+	rs->lane_index = -1;
+
+	return rs;
+}
+
+void gravm_runstack_destroy(
+		gravm_runstack_t *self)
+{
+	stackframe_t *cur;
+	stackframe_t *old;
+	int i;
+
+	if(self->cb->destroy != NULL)
+		self->cb->destroy(self->user);
+	cur = self->trash;
+	while(cur != NULL) {
+		old = cur;
+		cur = cur->prev;
+		free(old->emitted_edges);
+		free(old);
+	}
+	cur = self->top;
+	while(cur != NULL) {
+		old = cur;
+		cur = cur->prev;
+		free(old->emitted_edges);
+		free(old);
+	}
+	release_program(self);
+	free(self->visited);
+	free(self->dirty);
+	free(self->level_frames);
+	free(self->batch_ids);
+	free(self->batch_frames);
+	free(self->batch_results);
+	free(self->heap);
+	free(self->ids);
+	free(self->start);
+	for(i = 0; i < self->n_lanes; i++)
+		gravm_runstack_destroy(self->lanes[i]);
+	free(self->lanes);
+	free(self->lane_users);
+	free(self);
+}
+
+int gravm_runstack_set_options(
+		gravm_runstack_t *self,
+		int options)
+{
+	if(self->state == GRAVM_RS_STATE_EXECUTING || self->state == GRAVM_RS_STATE_THROWING)
+		return -EBUSY;
+	if(options != self->options) /* frames retained under other options may not match what a run produces now */
+		drop_retained(self);
+	self->options = options;
+	return 0;
+}
+
+/* grows the bitset to hold at least 'bits' bits; new bits are cleared */
+static int grow_bitset(
+		uint64_t **set,
+		int *words,
+		int bits)
+{
+	uint64_t *grown;
+	int n = (bits + 63) / 64;
+
+	if(n <= *words)
+		return 0;
+	grown = realloc(*set, sizeof(uint64_t) * n);
+	if(grown == NULL)
+		return -ENOMEM;
+	memset(grown + *words, 0, sizeof(uint64_t) * (n - *words));
+	*set = grown;
+	*words = n;
+	return 0;
+}
+
+int gravm_runstack_mark_dirty(
+		gravm_runstack_t *self,
+		int node)
+{
+	int ret;
+
+	if(self->program == NULL)
+		return -EINVAL;
+	else if(node < 0 || node + 1 >= self->program->n_nodes)
+		return -ENOENT;
+	ret = grow_bitset(&self->dirty, &self->dirty_words, self->program->n_nodes);
+	if(ret < 0)
+		return ret;
+	self->dirty[(node + 1) / 64] |= (uint64_t)1 << ((node + 1) % 64);
+	return 0;
+}
+
+int gravm_runstack_set_cache(
+		gravm_runstack_t *self,
+		gravm_cache_t *cache)
+{
+	if(self->state == GRAVM_RS_STATE_EXECUTING || self->state == GRAVM_RS_STATE_THROWING)
+		return -EBUSY;
+	self->cache = cache;
+	return 0;
+}
+
+int gravm_runstack_set_edge_mask(
+		gravm_runstack_t *self,
+		const uint64_t *mask)
+{
+	if(self->state == GRAVM_RS_STATE_EXECUTING || self->state == GRAVM_RS_STATE_THROWING)
+		return -EBUSY;
+	drop_retained(self); /* retained frames depend on the edges enabled when they were produced */
+	self->edge_mask = mask;
+	self->mask_key = mask == NULL ? 0 : atomic_fetch_add(&next_mask_key, 1);
+	return 0;
+}
+
+int gravm_runstack_set_trace(
+		gravm_runstack_t *self,
+		gravm_trace_t *trace)
+{
+#ifdef GRAVM_TRACE
+	if(self->state == GRAVM_RS_STATE_EXECUTING || self->state == GRAVM_RS_STATE_THROWING)
+		return -EBUSY;
+	self->trace = trace;
+	return 0;
+#else
+	return -ENOTSUP;
+#endif
+}
+
+void gravm_runstack_set_program_flags(
+		gravm_runstack_t *self,
+		int flags)
+{
+	self->program_flags = flags;
+}
+
+int gravm_runstack_prepare(
+		gravm_runstack_t *self,
+		void *user)
+{
+	gravm_program_t *program;
+
+	self->state = GRAVM_RS_STATE_CREATED;
+	while(self->top != NULL)
+		pop(self);
+	release_program(self);
+	self->user = user;
+
+	program = gravm_program_new_payload(self->cb, self->user, self->program_flags, self->edge_payload_size, self->node_payload_size);
+	if(program == NULL)
+		return errno;
+	self->program = program;
+	self->own_program = true;
+	self->state = GRAVM_RS_STATE_PREPARED;
+
+	return preallocate(self);
+}
+
+int gravm_runstack_prepare_program(
+		gravm_runstack_t *self,
+		gravm_program_t *program,
+		void *user)
+{
+	self->state = GRAVM_RS_STATE_CREATED;
+	while(self->top != NULL)
+		pop(self);
+	release_program(self);
+	self->user = user;
+
+	self->program = program;
+	self->own_program = false;
+	self->state = GRAVM_RS_STATE_PREPARED;
+
+	return preallocate(self);
+}
+
+int gravm_runstack_prepare_slot(
+		gravm_runstack_t *self,
+		gravm_program_slot_t *slot,
+		void *user)
+{
+	self->state = GRAVM_RS_STATE_CREATED;
+	while(self->top != NULL)
+		pop(self);
+	release_program(self);
+	self->user = user;
+
+	self->reader = slot_register(slot);
+	if(self->reader == NULL)
+		return -ENOMEM;
+	self->program = slot_pin(self->reader);
+	self->own_program = false;
+	self->state = GRAVM_RS_STATE_PREPARED;
+
+	return preallocate(self);
+}
+
+gravm_program_t *gravm_runstack_program(
+		gravm_runstack_t *self)
+{
+	return self->program;
+}
+
+int gravm_runstack_max_depth(
+		gravm_runstack_t *self)
+{
+	if(self->program == NULL)
+		return -EINVAL;
+	return program_depth(self->program);
+}
+
+int gravm_runstack_reset(
+		gravm_runstack_t *self)
+{
+	gravm_program_t *program;
+
+	if(self->program == NULL)
+		return -EINVAL;
+	while(self->top != NULL)
+		pop(self);
+	if(self->reader != NULL) { /* no frame references the old program anymore */
+		slot_unpin(self->reader);
+		program = slot_pin(self->reader);
+		if(program != self->program)
+			program_changed(self);
+		self->program = program;
+	}
+	self->throw_code = 0;
+	self->starting = false;
+	self->start_parent = NULL;
+	self->state = GRAVM_RS_STATE_PREPARED;
+	return 0;
+}
+
+static int check_mutable(
+		gravm_runstack_t *self)
+{
+	if(self->program == NULL)
+		return -EINVAL;
+	else if(self->state == GRAVM_RS_STATE_EXECUTING || self->state == GRAVM_RS_STATE_THROWING)
+		return -EBUSY;
+	else if(!self->own_program)
+		return -EPERM;
+	else
+		return 0;
+}
+
+int gravm_runstack_edge_add(
+		gravm_runstack_t *self,
+		int id,
+		const gravm_runstack_edgedef_t *def)
+{
+	int reset;
+	int ret;
+
+	ret = check_mutable(self);
+	if(ret < 0)
+		return ret;
+	ret = program_edge_insert(self->program, id, def, self->cb, self->user);
+	if(ret == -EEXIST || ret == -EINVAL) /* rejected before touching the program */
+		return ret;
+	program_changed(self); /* even if the edge has not been added, nodes may have been */
+	reset = gravm_runstack_reset(self);
+	return ret < 0 ? ret : reset;
+}
+
+int gravm_runstack_edge_remove(
+		gravm_runstack_t *self,
+		int id)
+{
+	int ret;
+
+	ret = check_mutable(self);
+	if(ret < 0)
+		return ret;
+	ret = program_edge_remove(self->program, id);
+	if(ret < 0) /* failures leave the program untouched */
+		return ret;
+	program_changed(self);
+	return gravm_runstack_reset(self);
+}
+
+int gravm_runstack_relayout(
+		gravm_runstack_t *self,
+		const unsigned int *counts,
+		int n_counts)
+{
+	int ret;
+
+	ret = check_mutable(self);
+	if(ret < 0)
+		return ret;
+	ret = program_relayout(self->program, counts, n_counts);
+	if(ret < 0)
+		return ret;
+	program_changed(self);
+	return gravm_runstack_reset(self);
+}
+
+/* program of the current frame, which differs from the runstack's one below a call */
+static const gravm_program_t *current_program(
+		gravm_runstack_t *self)
+{
+	if(self->top != NULL)
+		return self->top->program;
+	return self->program;
+}
+
+void *gravm_runstack_edge_payload(
+		gravm_runstack_t *self)
+{
+	const gravm_program_t *program = current_program(self);
+	const edge_entry_t *edge;
+
+	if(program == NULL || program->edge_payload_size == 0 || (self->top == NULL && self->cb_edge == NULL))
+		return NULL;
+	if(self->cb_edge == NULL && self->top->emitted)
+		return NULL;
+	edge = self->cb_edge != NULL ? self->cb_edge : self->top->edge;
+	return program_edge_payload(edge);
+}
+
+void *gravm_runstack_node_payload(
+		gravm_runstack_t *self)
+{
+	const gravm_program_t *program = current_program(self);
+	const range_t *node;
+
+	if(program == NULL || program->node_payload_size == 0 || (self->top == NULL && self->cb_edge == NULL))
+		return NULL;
+	node = self->cb_edge != NULL ? program_node(program, self->cb_edge->target) : self->top->out;
+	return program_node_payload(node);
+}
+
+int gravm_runstack_emit(
+		gravm_runstack_t *self,
+		int id,
+		int target,
+		int priority)
+{
+	stackframe_t *top = self->top;
+	edge_entry_t *edges;
+	int capacity;
+	int i;
+
+	if((self->options & (GRAVM_RS_OPT_LEVEL_ORDER | GRAVM_RS_OPT_PRIORITY)) != 0)
+		return -ENOTSUP;
+	else if(self->state != GRAVM_RS_STATE_EXECUTING || top == NULL || top->ip != GRAVM_RS_IP_NODE_ENTER)
+		return -EINVAL;
+	else if(target < 0 || target + 1 >= top->program->n_nodes)
+		return -ENOENT;
+	if(top->n_emitted == top->emitted_capacity) {
+		capacity = top->emitted_capacity == 0 ? 8 : top->emitted_capacity * 2;
+		edges = realloc(top->emitted_edges, sizeof(edge_entry_t) * capacity);
+		if(edges == NULL)
+			return -ENOMEM;
+		top->emitted_edges = edges;
+		top->emitted_capacity = capacity;
+	}
+
+	/* keep the edges sorted by priority; edges of equal priority stay in the order they were emitted */
+	for(i = top->n_emitted; i > 0 && top->emitted_edges[i - 1].priority > priority; i--)
+		top->emitted_edges[i] = top->emitted_edges[i - 1];
+	top->emitted_edges[i].source = top->edge->target;
+	top->emitted_edges[i].priority = priority;
+	top->emitted_edges[i].target = target;
+	top->emitted_edges[i].id = id;
+	top->n_emitted++;
+	if(priority < 0)
+		top->emitted_boundary++;
+	return 0;
+}
+
+int gravm_runstack_suspend(
+		gravm_runstack_t *self)
+{
+	self->suspended = true;
+	return GRAVM_RS_SUCCESS;
+}
+
+int gravm_runstack_run(
+		gravm_runstack_t *self)
+{
+	int ret;
+	self->suspended = false;
+
+	if((self->options & GRAVM_RS_OPT_PRIORITY) != 0)
+		return run_priority(self);
+	else if((self->options & GRAVM_RS_OPT_LEVEL_ORDER) != 0)
+		return run_levels(self);
+	while(true) {
+		ret = gravm_runstack_step(self);
+		switch(ret) {
+			case GRAVM_RS_TRUE:
+				break;
+			case GRAVM_RS_FALSE:
+				return GRAVM_RS_SUCCESS;
+			default:
+				return ret;
+		}
+		if(self->suspended)
+			return GRAVM_RS_SUSPENDED;
+	}
+}
+
+/* makes sure the callback.node_run_batch/node_run_lanes arguments hold at least 'n' entries */
+static int grow_batch(
+		gravm_runstack_t *self,
+		int n)
+{
+	int *ids;
+	void **frames;
+	int *results;
+
+	if(n <= self->batch_capacity)
+		return 0;
+	ids = realloc(self->batch_ids, sizeof(int) * n);
+	if(ids == NULL)
+		return -ENOMEM;
+	self->batch_ids = ids;
+	frames = realloc(self->batch_frames, sizeof(void*) * n);
+	if(frames == NULL)
+		return -ENOMEM;
+	self->batch_frames = frames;
+	results = realloc(self->batch_results, sizeof(int) * n);
+	if(results == NULL)
+		return -ENOMEM;
+	self->batch_results = results;
+	self->batch_capacity = n;
+	return 0;
+}
+
+/* makes sure there are at least 'n' lanes, configured like 'self' */
+static int grow_lanes(
+		gravm_runstack_t *self,
+		int n)
+{
+	gravm_runstack_t **lanes;
+	gravm_runstack_t *lane;
+	void **users;
+	int ret;
+
+	if(n > self->n_lanes) {
+		lanes = realloc(self->lanes, sizeof(gravm_runstack_t*) * n);
+		if(lanes == NULL)
+			return -ENOMEM;
+		self->lanes = lanes;
+		users = realloc(self->lane_users, sizeof(void*) * n);
+		if(users == NULL)
+			return -ENOMEM;
+		self->lane_users = users;
+	}
+	ret = grow_batch(self, n);
+	if(ret < 0)
+		return ret;
+	self->lane_cb = *self->cb;
+	self->lane_cb.destroy = NULL; /* the user contexts belong to the caller */
+	while(self->n_lanes < n) {
+		lane = gravm_runstack_new_payload(&self->lane_cb, self->max_stack_size, self->framedata_size, self->edge_payload_size, self->node_payload_size);
+		if(lane == NULL)
+			return errno;
+		lane->lane_index = self->n_lanes;
+		self->lanes[self->n_lanes++] = lane;
+	}
+	return 0;
+}
+
+/* runs the nodes of all lanes which are still running, each parked in front of node_run, with a single
+ * callback.node_run_lanes call; returns the number of lanes that have failed fatally and are done */
+static int run_lanes(
+		gravm_runstack_t *self,
+		int n,
+		int *results)
+{
+	gravm_runstack_t *lane;
+	int failed = 0;
+	int ret;
+	int err;
+	int i;
+	int k;
+
+	for(i = 0, k = 0; i < n; i++) {
+		if(results[i] != GRAVM_RS_TRUE)
+			continue;
+		lane = self->lanes[i];
+		self->lane_users[k] = lane->user;
+		self->batch_ids[k] = lane->top->edge->target;
+		self->batch_frames[k] = lane->top->user;
+		self->batch_results[k] = GRAVM_RS_FALSE;
+		k++;
+	}
+	ret = self->cb->node_run_lanes(k, self->lane_users, self->batch_ids, self->batch_frames, self->batch_results);
+	err = errno;
+
+	for(i = 0, k = 0; i < n; i++) {
+		if(results[i] != GRAVM_RS_TRUE)
+			continue;
+		lane = self->lanes[i];
+		TRACE_STEP(lane)
+		errno = err;
+		node_run_done(lane, ret == GRAVM_RS_SUCCESS ? self->batch_results[k] : ret);
+		if(lane->state == GRAVM_RS_STATE_EXECUTED_ERROR) {
+			results[i] = GRAVM_RS_FATAL;
+			failed++;
+		}
+		k++;
+	}
+	return failed;
+}
+
+int gravm_runstack_run_batch(
+		gravm_runstack_t *self,
+		gravm_program_t *program,
+		void *const *users,
+		int n,
+		int *results)
+{
+	gravm_runstack_t *lane;
+	int active;
+	int parked;
+	int ret;
+	int i;
+
+	if(n < 0 || self->state == GRAVM_RS_STATE_EXECUTING || self->state == GRAVM_RS_STATE_THROWING) {
+		errno = -EINVAL;
+		return GRAVM_RS_FATAL;
+	}
+	else if((self->options & (GRAVM_RS_OPT_LEVEL_ORDER | GRAVM_RS_OPT_PRIORITY)) != 0) {
+		errno = -ENOTSUP;
+		return GRAVM_RS_FATAL;
+	}
+	ret = grow_lanes(self, n);
+	if(ret < 0) {
+		errno = ret;
+		return GRAVM_RS_FATAL;
+	}
+	for(i = 0; i < n; i++) {
+		lane = self->lanes[i];
+		lane->options = self->options;
+		lane->cache = self->cache;
+		lane->edge_mask = self->edge_mask;
+		lane->mask_key = self->mask_key;
+		lane->trace = self->trace;
+		lane->parking = self->cb->node_run_lanes != NULL;
+		ret = gravm_runstack_prepare_program(lane, program, users[i]);
+		if(ret < 0) {
+			errno = ret;
+			return GRAVM_RS_FATAL;
+		}
+		results[i] = GRAVM_RS_TRUE; /* still running */
+	}
+
+	/* round robin: one callback per lane and turn, so the lanes progress at roughly the same pace. with
+	 * callback.node_run_lanes, a lane reaching node_run waits until all other running lanes have done so as well */
+	for(active = n; active > 0;) {
+		parked = 0;
+		for(i = 0; i < n; i++) {
+			if(results[i] != GRAVM_RS_TRUE)
+				continue;
+			ret = gravm_runstack_step(self->lanes[i]);
+			if(ret == GRAVM_RS_TRUE)
+				continue;
+			else if(ret == LANE_PARKED) {
+				parked++;
+				continue;
+			}
+			else if(ret == GRAVM_RS_FALSE)
+				results[i] = GRAVM_RS_SUCCESS;
+			else
+				results[i] = ret;
+			active--;
+		}
+		if(parked > 0 && parked == active)
+			active -= run_lanes(self, n, results);
+	}
+	return GRAVM_RS_SUCCESS;
+}
+
+int gravm_runstack_run_from(
+		gravm_runstack_t *self,
+		const int *edge_ids,
+		int n,
+		void *parent)
+{
+	int *start;
+	int ret;
+	int i;
+
+	if(self->state != GRAVM_RS_STATE_PREPARED || n <= 0) {
+		errno = -EINVAL;
+		return GRAVM_RS_FATAL;
+	}
+	else if((self->options & (GRAVM_RS_OPT_LEVEL_ORDER | GRAVM_RS_OPT_PRIORITY)) != 0) {
+		errno = -ENOTSUP;
+		return GRAVM_RS_FATAL;
+	}
+	if(n > self->start_capacity) {
+		start = realloc(self->start, sizeof(int) * n);
+		if(start == NULL) {
+			errno = -ENOMEM;
+			return GRAVM_RS_FATAL;
+		}
+		self->start = start;
+		self->start_capacity = n;
+	}
+	for(i = 0; i < n; i++) {
+		ret = program_find(self->program, edge_ids[i]);
+		if(ret < 0) {
+			errno = ret;
+			return GRAVM_RS_FATAL;
+		}
+		self->start[i] = ret;
+	}
+	self->n_start = n;
+	self->starting = true;
+	self->start_parent = parent;
+	return gravm_runstack_run(self);
+}
+
+/* invalidates the retained frames of all edges whose target node can reach a dirty node (including the dirty node
+ * itself) by walking the incoming edges backwards from the dirty nodes. clears the dirty nodes afterwards */
+static int invalidate_dirty(
+		gravm_runstack_t *self)
+{
+	const gravm_program_t *program = self->program;
+	int *first; /* incoming edges of node table entry x: sources[first[x]] up to sources[first[x + 1]] */
+	int *sources; /* node table entries */
+	int *queue;
+	char *stale;
+	int n_queue = 0;
+	int node;
+	int i;
+
+	for(i = 0; i < self->dirty_words && self->dirty[i] == 0; i++);
+	if(i == self->dirty_words)
+		return 0;
+
+	first = calloc(program->n_nodes + 1, sizeof(int));
+	sources = malloc(sizeof(int) * (program->n_edges + 1));
+	queue = malloc(sizeof(int) * program->n_nodes);
+	stale = calloc(program->n_nodes, 1);
+	if(first == NULL || sources == NULL || queue == NULL || stale == NULL) {
+		free(first);
+		free(sources);
+		free(queue);
+		free(stale);
+		return -ENOMEM;
+	}
+
+	for(i = 0; i < program->n_edges; i++)
+		first[program_edge(program, i)->target + 2]++;
+	for(i = 0; i < program->n_nodes; i++)
+		first[i + 1] += first[i];
+	memcpy(queue, first, sizeof(int) * program->n_nodes); /* insertion positions */
+	for(i = 0; i < program->n_edges; i++)
+		sources[queue[program_edge(program, i)->target + 1]++] = program_edge(program, i)->source + 1;
+
+	for(i = 0; i < program->n_nodes && i < self->dirty_words * 64; i++)
+		if((self->dirty[i / 64] & ((uint64_t)1 << (i % 64))) != 0) {
+			stale[i] = true;
+			queue[n_queue++] = i;
+		}
+	while(n_queue > 0) {
+		node = queue[--n_queue];
+		for(i = first[node]; i < first[node + 1]; i++)
+			if(!stale[sources[i]]) {
+				stale[sources[i]] = true;
+				queue[n_queue++] = sources[i];
+			}
+	}
+
+	for(i = 0; i < program->n_edges; i++)
+		if(stale[program_edge(program, i)->target + 1])
+			self->retained_valid[i / 64] &= ~((uint64_t)1 << (i % 64));
+	memset(self->dirty, 0, sizeof(uint64_t) * self->dirty_words);
+
+	free(first);
+	free(sources);
+	free(queue);
+	free(stale);
+	return 0;
+}
+
+/* per-run initialization of optional state */
+static int begin_run(
+		gravm_runstack_t *self)
+{
+	int words;
+	int ret;
+
+	ret = program_commit(self->program); /* edits since the previous run */
+	if(ret < 0)
+		return ret;
+	ret = preallocate(self);
+	if(ret < 0)
+		return ret;
+	init_throw_observed(self);
+	if((self->options & GRAVM_RS_OPT_VISIT_ONCE) != 0) {
+		ret = grow_bitset(&self->visited, &self->visited_words, self->program->n_nodes);
+		if(ret < 0)
+			return ret;
+		memset(self->visited, 0, sizeof(uint64_t) * self->visited_words);
+	}
+	if((self->options & (GRAVM_RS_OPT_INCREMENTAL | GRAVM_RS_OPT_LEVEL_ORDER | GRAVM_RS_OPT_PRIORITY)) == GRAVM_RS_OPT_INCREMENTAL) {
+		if(self->retained == NULL) {
+			words = (self->program->n_edges + 63) / 64;
+			self->retained = malloc((size_t)self->program->n_edges * self->framedata_size + 1);
+			self->retained_valid = calloc(words + 1, sizeof(uint64_t));
+			if(self->retained == NULL || self->retained_valid == NULL) {
+				drop_retained(self);
+				return -ENOMEM;
+			}
+		}
+		ret = invalidate_dirty(self);
+		if(ret < 0)
+			return ret;
+	}
+	return 0;
+}
+
+/***** level order *****/
+
+enum {
+	LEVEL_NONE, /* descend returned GRAVM_RS_FALSE */
+	LEVEL_DESCENDED,
+	LEVEL_BEGUN,
+	LEVEL_ENTERED,
+	LEVEL_RAN, /* node_run returned GRAVM_RS_TRUE, outgoing edges are to be expanded */
+	LEVEL_EXPANDED /* outgoing edges have been prepared */
+};
+
+typedef struct {
+	const edge_entry_t *edge;
+	int parent; /* index of the parent frame; -1: root edge */
+	int progress; /* LEVEL_*: how far the frame got, i.e. what needs to be completed */
+	int depth; /* root edges: 0 */
+	int pending; /* children which have not been completed yet */
+	int n_prepared; /* outgoing edges prepared and not yet unprepared, in the order of execution */
+} level_frame_t;
+
+static inline level_frame_t *level_frame(
+		gravm_runstack_t *self,
+		int index)
+{
+	return (level_frame_t*)(self->level_frames + (size_t)index * self->level_stride);
+}
+
+static inline void *level_user(
+		level_frame_t *frame)
+{
+	return (char*)frame + PAYLOAD_ALIGN_UP(sizeof(level_frame_t));
+}
+
+static void *level_parent_user(
+		gravm_runstack_t *self,
+		level_frame_t *frame)
+{
+	if(frame->parent < 0)
+		return NULL;
+	return level_user(level_frame(self, frame->parent));
+}
+
+/* invalidates pointers to frames */
+static int level_push(
+		gravm_runstack_t *self,
+		const edge_entry_t *edge,
+		int parent)
+{
+	level_frame_t *frame;
+	char *frames;
+	int capacity;
+	int depth = parent < 0 ? 0 : level_frame(self, parent)->depth + 1;
+
+	if(self->max_stack_size >= 0 && depth >= self->max_stack_size)
+		return -EOVERFLOW;
+	if(self->n_level_frames == self->level_capacity) {
+		capacity = self->level_capacity == 0 ? 64 : self->level_capacity * 2;
+		frames = realloc(self->level_frames, (size_t)capacity * self->level_stride);
+		if(frames == NULL)
+			return -ENOMEM;
+		self->level_frames = frames;
+		self->level_capacity = capacity;
+	}
+	frame = level_frame(self, self->n_level_frames++);
+	memset(frame, 0, self->level_stride);
+	frame->edge = edge;
+	frame->parent = parent;
+	frame->progress = LEVEL_NONE;
+	frame->depth = depth;
+	if(parent >= 0)
+		level_frame(self, parent)->pending++;
+	return 0;
+}
+
+/* aborts the prepared outgoing edges of every frame which has not been completed yet and ascends from it (throwing),
+ * children before their parents, as the depth-first unwinder does if no catch callback is set */
+static int level_unwind(
+		gravm_runstack_t *self)
+{
+	level_frame_t *frame;
+	const range_t *out;
+	const int *ids;
+	int ret;
+	int i;
+	int k;
+
+	for(i = self->n_level_frames - 1; i >= 0; i--) {
+		frame = level_frame(self, i);
+		out = program_node(self->program, frame->edge->target);
+		if(frame->n_prepared > 0 && self->cb->edges_abort != NULL) {
+			ids = collect_ids(self, self->program, out->lower, out->lower + frame->n_prepared);
+			if(ids == NULL) {
+				errno = -ENOMEM;
+				return GRAVM_RS_FATAL;
+			}
+			self->cb_edge = frame->edge;
+			ret = self->cb->edges_abort(self->user, self->throw_code, frame->n_prepared, ids, level_user(frame));
+			if(ret != GRAVM_RS_SUCCESS)
+				return GRAVM_RS_FATAL;
+		}
+		else if(frame->n_prepared > 0 && self->cb->edge_abort != NULL)
+			for(k = out->lower + frame->n_prepared - 1; k >= out->lower; k--) {
+				self->cb_edge = program_edge(self->program, k);
+				ret = self->cb->edge_abort(self->user, self->throw_code, self->cb_edge->id, level_user(frame));
+				if(ret != GRAVM_RS_SUCCESS)
+					return GRAVM_RS_FATAL;
+			}
+		frame->n_prepared = 0;
+		if(frame->progress >= LEVEL_DESCENDED && self->cb->ascend != NULL) {
+			frame->progress = LEVEL_NONE;
+			self->cb_edge = frame->edge;
+			ret = self->cb->ascend(self->user, frame->edge->id, true, self->throw_code, level_parent_user(self, frame), level_user(frame));
+			if(ret != GRAVM_RS_SUCCESS)
+				return GRAVM_RS_FATAL;
+		}
+		frame->progress = LEVEL_NONE;
+	}
+	return GRAVM_RS_SUCCESS;
+}
+
+/* there is no catch handling in level order: THROW unwinds all frames (see level_unwind()) and ends the run, FATAL
+ * ends it right away */
+static int level_abort(
+		gravm_runstack_t *self,
+		int ret)
+{
+	switch(ret) {
+		case GRAVM_RS_THROW:
+			self->throw_code = errno;
+			if(level_unwind(self) != GRAVM_RS_SUCCESS)
+				ret = GRAVM_RS_FATAL;
+			else
+				errno = self->throw_code;
+			break;
+		case GRAVM_RS_FATAL:
+			break;
+		default:
+			assert(false);
+			errno = -EINVAL;
+			ret = GRAVM_RS_FATAL;
+			break;
+	}
+	self->cb_edge = NULL;
+	self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
+	return ret;
+}
+
+/* descend, edge_begin and node_enter (or node_revisit) */
+static int level_enter(
+		gravm_runstack_t *self,
+		int index)
+{
+	level_frame_t *frame = level_frame(self, index);
+	int ret;
+
+	self->cb_edge = frame->edge;
+	if(self->cb->descend != NULL)
+		ret = self->cb->descend(self->user, frame->edge->id, level_parent_user(self, frame), level_user(frame));
+	else
+		ret = GRAVM_RS_TRUE;
+	if(ret != GRAVM_RS_TRUE)
+		return ret;
+	frame->progress = LEVEL_DESCENDED;
+
+	if(self->cb->edge_begin != NULL)
+		ret = self->cb->edge_begin(self->user, frame->edge->id, level_user(frame));
+	else
+		ret = GRAVM_RS_TRUE;
+	if(ret != GRAVM_RS_TRUE)
+		return ret;
+	frame->progress = LEVEL_BEGUN;
+
+	if((self->options & GRAVM_RS_OPT_VISIT_ONCE) != 0 && visit(self, frame->edge->target)) {
+		if(self->cb->node_revisit != NULL)
+			return self->cb->node_revisit(self->user, frame->edge->target, level_user(frame));
+		return GRAVM_RS_SUCCESS;
+	}
+	if(self->cb->node_enter != NULL)
+		ret = self->cb->node_enter(self->user, frame->edge->target, level_user(frame));
+	else
+		ret = GRAVM_RS_TRUE;
+	if(ret != GRAVM_RS_TRUE)
+		return ret;
+	frame->progress = LEVEL_ENTERED;
+	return GRAVM_RS_SUCCESS;
+}
+
+static int level_run_node(
+		gravm_runstack_t *self,
+		int index)
+{
+	level_frame_t *frame = level_frame(self, index);
+	int ret;
+
+	if(frame->progress != LEVEL_ENTERED)
+		return GRAVM_RS_SUCCESS;
+	self->cb_edge = frame->edge;
+	if(self->cb->node_run != NULL)
+		ret = self->cb->node_run(self->user, frame->edge->target, level_user(frame));
+	else
+		ret = GRAVM_RS_TRUE;
+	switch(ret) {
+		case GRAVM_RS_TRUE:
+			frame->progress = LEVEL_RAN;
+			return GRAVM_RS_SUCCESS;
+		case GRAVM_RS_FALSE:
+			return GRAVM_RS_SUCCESS;
+		default:
+			return ret;
+	}
+}
+
+/* node_run for all entered nodes of the level [lower, upper) */
+static int level_run(
+		gravm_runstack_t *self,
+		int lower,
+		int upper)
+{
+	level_frame_t *frame;
+	int n = 0;
+	int ret;
+	int i;
 
-static void throw_loop_outgoing_post(
-		gravm_runstack_t *self)
-{
-	if(self->cb->edge_abort != NULL && it_end(self->edges, &self->top->out_it, self->top->edge->out_upper, self->top->edge->out_lower))
-		self->top->out_cur = self->top->out_it.it.element;
-	else
-		self->top->out_cur = NULL;
-	self->top->ip = GRAVM_RS_IP_BEGIN_EDGE_UNPREPARE;
+	if(self->cb->node_run_batch == NULL) {
+		for(i = lower; i < upper; i++) {
+			ret = level_run_node(self, i);
+			if(ret != GRAVM_RS_SUCCESS)
+				return ret;
+		}
+		return GRAVM_RS_SUCCESS;
+	}
+
+	ret = grow_batch(self, upper - lower);
+	if(ret < 0) {
+		errno = ret;
+		return GRAVM_RS_FATAL;
+	}
+	for(i = lower; i < upper; i++) {
+		frame = level_frame(self, i);
+		if(frame->progress != LEVEL_ENTERED)
+			continue;
+		self->batch_ids[n] = frame->edge->target;
+		self->batch_frames[n] = level_user(frame);
+		self->batch_results[n] = GRAVM_RS_FALSE;
+		n++;
+	}
+	if(n == 0)
+		return GRAVM_RS_SUCCESS;
+	self->cb_edge = NULL;
+	ret = self->cb->node_run_batch(self->user, n, self->batch_ids, self->batch_frames, self->batch_results);
+	if(ret != GRAVM_RS_SUCCESS)
+		return ret;
+	for(i = lower, n = 0; i < upper; i++) {
+		frame = level_frame(self, i);
+		if(frame->progress != LEVEL_ENTERED)
+			continue;
+		if(self->batch_results[n++] == GRAVM_RS_TRUE)
+			frame->progress = LEVEL_RAN;
+	}
+	return GRAVM_RS_SUCCESS;
 }
 
-static void throw_begin_edge_unprepare(
-		gravm_runstack_t *self)
+/* prepares the outgoing edges of the node and appends them to the next level */
+static int level_expand(
+		gravm_runstack_t *self,
+		int index)
 {
+	const range_t *out = program_node(self->program, level_frame(self, index)->edge->target);
+	const edge_entry_t *edge;
+	const int *ids;
 	int ret;
+	int i;
 
-	if(self->top->out_cur != NULL) { /* prepared edges remaining, abort them */
-		assert(self->cb->edge_abort != NULL);
-		ret = self->cb->edge_abort(self->user, self->throw_code, self->top->out_cur->id, self->top->user);
-		self->invoked = true;
-		if(it_prev(&self->top->out_it))
-			self->top->out_cur = self->top->out_it.it.element;
-		else
-			self->top->out_cur = NULL;
-		switch(ret) {
-			case GRAVM_RS_SUCCESS:
-				return;
-			THROW_EXCEPTION_CASES
+	program_touch(self->program, level_frame(self, index)->edge->target);
+	if(self->cb->edges_prepare != NULL && out->lower < out->upper) {
+		ids = collect_ids(self, self->program, out->lower, out->upper);
+		if(ids == NULL) {
+			errno = -ENOMEM;
+			return GRAVM_RS_FATAL;
 		}
+		self->cb_edge = level_frame(self, index)->edge;
+		ret = self->cb->edges_prepare(self->user, out->upper - out->lower, ids, level_user(level_frame(self, index)));
+		if(ret != GRAVM_RS_SUCCESS)
+			return ret;
 	}
-	else { /* no prepared edges remaining, call node_catch */
-		if(self->cb->node_catch != NULL) {
-			ret = self->cb->node_catch(self->user, self->throw_code, self->top->edge->target, self->top->user);
-			self->invoked = true;
+	for(i = out->lower; i < out->upper; i++) {
+		edge = program_edge(self->program, i);
+		if(self->cb->edge_prepare != NULL && self->cb->edges_prepare == NULL) {
+			self->cb_edge = edge;
+			ret = self->cb->edge_prepare(self->user, edge->id, level_user(level_frame(self, index)));
+			if(ret != GRAVM_RS_SUCCESS)
+				return ret;
 		}
-		else
-			ret = GRAVM_RS_FALSE;
-		switch(ret) {
-			case GRAVM_RS_FALSE:
-				self->top->ip = GRAVM_RS_IP_NODE_LEAVE;
-				return;
-			case GRAVM_RS_TRUE:
-				self->top->ip = GRAVM_RS_IP_EDGE_END;
-				self->state = GRAVM_RS_STATE_EXECUTING;
-				return;
-			case GRAVM_RS_THROW:
-				self->throw_code = errno;
-				self->top->ip = GRAVM_RS_IP_NODE_LEAVE;
-				return;
-			THROW_FATAL_CASES
+		level_frame(self, index)->n_prepared = i + 1 - out->lower;
+		if(!edge_enabled(self, edge))
+			continue;
+		ret = level_push(self, edge, index);
+		if(ret < 0) {
+			errno = ret;
+			return GRAVM_RS_FATAL;
 		}
 	}
+	level_frame(self, index)->progress = LEVEL_EXPANDED;
+	return GRAVM_RS_SUCCESS;
 }
 
-static void throw_loop_edge_unprepare(
-		gravm_runstack_t *self)
-{
-	if(self->cb->edge_abort != NULL && it_prev(&self->top->out_it))
-		self->top->out_cur = self->top->out_it.it.element;
-	else
-		self->top->out_cur = NULL;
-	self->top->ip = GRAVM_RS_IP_BEGIN_EDGE_UNPREPARE;
-}
-
-static void throw_node_leave(
-		gravm_runstack_t *self)
+/* edge_unprepare, node_leave, edge_end and ascend, as far as the frame got */
+static int level_complete(
+		gravm_runstack_t *self,
+		int index)
 {
+	level_frame_t *frame = level_frame(self, index);
+	const range_t *out = program_node(self->program, frame->edge->target);
+	const int *ids;
+	int progress;
 	int ret;
+	int i;
 
-	if(self->cb->edge_catch != NULL) {
-		ret = self->cb->edge_catch(self->user, self->throw_code, self->top->edge->id, self->top->user);
-		self->invoked = true;
+	if(frame->progress >= LEVEL_EXPANDED && self->cb->edges_unprepare != NULL && out->lower < out->upper) {
+		ids = collect_ids(self, self->program, out->lower, out->upper);
+		if(ids == NULL) {
+			errno = -ENOMEM;
+			return GRAVM_RS_FATAL;
+		}
+		self->cb_edge = frame->edge;
+		frame->n_prepared = 0;
+		ret = self->cb->edges_unprepare(self->user, out->upper - out->lower, ids, level_user(frame));
+		if(ret != GRAVM_RS_SUCCESS)
+			return ret;
 	}
-	else
-		ret = GRAVM_RS_FALSE;
-	switch(ret) {
-		case GRAVM_RS_FALSE:
-			self->top->ip++;
-			return;
-		case GRAVM_RS_TRUE:
-			self->top->ip = GRAVM_RS_IP_EDGE_NEXT;
-			self->state = GRAVM_RS_STATE_EXECUTING;
-			return;
-		case GRAVM_RS_THROW:
-			self->throw_code = errno;
-			self->top->ip++;
-			return;
-		THROW_FATAL_CASES
+	else if(frame->progress >= LEVEL_EXPANDED && self->cb->edge_unprepare != NULL)
+		for(i = out->upper - 1; i >= out->lower; i--) {
+			self->cb_edge = program_edge(self->program, i);
+			frame->n_prepared = i - out->lower;
+			ret = self->cb->edge_unprepare(self->user, self->cb_edge->id, level_user(frame));
+			if(ret != GRAVM_RS_SUCCESS)
+				return ret;
+		}
+	frame->n_prepared = 0;
+	self->cb_edge = frame->edge;
+	if(frame->progress >= LEVEL_ENTERED && self->cb->node_leave != NULL) {
+		ret = self->cb->node_leave(self->user, frame->edge->target, level_user(frame));
+		if(ret != GRAVM_RS_SUCCESS)
+			return ret;
+	}
+	if(frame->progress >= LEVEL_BEGUN && self->cb->edge_end != NULL) {
+		ret = self->cb->edge_end(self->user, frame->edge->id, level_user(frame));
+		if(ret != GRAVM_RS_SUCCESS)
+			return ret;
+	}
+	progress = frame->progress;
+	frame->progress = LEVEL_NONE; /* completed, not to be unwound even if ascend throws */
+	if(progress >= LEVEL_DESCENDED && self->cb->ascend != NULL) {
+		ret = self->cb->ascend(self->user, frame->edge->id, false, 0, level_parent_user(self, frame), level_user(frame));
+		if(ret != GRAVM_RS_SUCCESS)
+			return ret;
 	}
+	return GRAVM_RS_SUCCESS;
 }
 
-static void throw_edge_end(
+/* common beginning of run_levels() and run_priority(), creates the frames of the root edges. returns GRAVM_RS_TRUE
+ * if the run is to be continued, otherwise the return value of gravm_runstack_run() */
+static int level_start(
 		gravm_runstack_t *self)
 {
+	const range_t *root;
 	int ret;
+	int i;
 
-	if(self->cb->ascend != NULL) {
-		void *user;
-		if(self->top->prev == NULL)
-			user = self->top->prev->user;
-		else
-			user = NULL;
-		ret = self->cb->ascend(self->user, self->top->edge->id, true, self->throw_code, user, self->top->user);
-		self->invoked = true;
+	switch(self->state) {
+		case GRAVM_RS_STATE_PREPARED:
+			break;
+		case GRAVM_RS_STATE_EXECUTED:
+		case GRAVM_RS_STATE_EXECUTED_ERROR:
+			return GRAVM_RS_SUCCESS;
+		default:
+			errno = -EINVAL;
+			return GRAVM_RS_FATAL;
+	}
+	if(self->program->callees != NULL) { /* see gravm_program_call() */
+		errno = -ENOTSUP;
+		return GRAVM_RS_FATAL;
+	}
+	self->state = GRAVM_RS_STATE_EXECUTING;
+	ret = begin_run(self);
+	if(ret < 0) {
+		errno = ret;
+		return level_abort(self, GRAVM_RS_FATAL);
 	}
-	else
-		ret = GRAVM_RS_SUCCESS;
 
-/*	if(self->top->prev != NULL && self->cb->ascend != NULL) {
-		ret = self->cb->ascend(self->user, self->top->edge->id, true, self->throw_code, self->top->prev->user, self->top->user);
-		self->invoked = true;
+	self->level_stride = program_stride(sizeof(level_frame_t), self->framedata_size);
+	self->n_level_frames = 0;
+	root = program_node(self->program, GRAVM_RS_ROOT);
+	if(root->lower >= root->upper) {
+		errno = -ENOENT;
+		return level_abort(self, GRAVM_RS_FATAL);
 	}
-	else
-		ret = GRAVM_RS_SUCCESS;*/
-	switch(ret) {
-		case GRAVM_RS_SUCCESS:
-			self->top->ip++;
-			return;
-		THROW_EXCEPTION_CASES
+	for(i = root->lower; i < root->upper; i++) {
+		if(!edge_enabled(self, program_edge(self->program, i)))
+			continue;
+		ret = level_push(self, program_edge(self->program, i), -1);
+		if(ret < 0) {
+			errno = ret;
+			return level_abort(self, GRAVM_RS_FATAL);
+		}
 	}
-	pop(self);
+	return GRAVM_RS_TRUE;
 }
 
-static void throw_ascend(
+static int run_levels(
 		gravm_runstack_t *self)
 {
-	pop(self);
+	int lower;
+	int upper;
+	int ret;
+	int i;
+
+	ret = level_start(self);
+	if(ret != GRAVM_RS_TRUE)
+		return ret;
+	for(lower = 0; lower < self->n_level_frames; lower = upper) {
+		upper = self->n_level_frames;
+		for(i = lower; i < upper; i++) {
+			ret = level_enter(self, i);
+			if(ret != GRAVM_RS_SUCCESS)
+				return level_abort(self, ret);
+		}
+		ret = level_run(self, lower, upper);
+		if(ret != GRAVM_RS_SUCCESS)
+			return level_abort(self, ret);
+		for(i = lower; i < upper; i++) {
+			if(level_frame(self, i)->progress != LEVEL_RAN)
+				continue;
+			ret = level_expand(self, i);
+			if(ret != GRAVM_RS_SUCCESS)
+				return level_abort(self, ret);
+		}
+	}
+
+	/* children are stored behind their parents */
+	for(i = self->n_level_frames - 1; i >= 0; i--) {
+		ret = level_complete(self, i);
+		if(ret != GRAVM_RS_SUCCESS)
+			return level_abort(self, ret);
+	}
+	self->cb_edge = NULL;
+	self->state = GRAVM_RS_STATE_EXECUTED;
+	return GRAVM_RS_SUCCESS;
 }
 
-static void throw_pop(
-		gravm_runstack_t *self)
+/***** priority scheduling *****/
+
+/* lower edge priority first, ties are broken by creation order */
+static bool heap_less(
+		gravm_runstack_t *self,
+		int a,
+		int b)
 {
-	pop(self);
+	int pa = level_frame(self, a)->edge->priority;
+	int pb = level_frame(self, b)->edge->priority;
+
+	if(pa != pb)
+		return pa < pb;
+	return a < b;
 }
 
-gravm_runstack_t *gravm_runstack_new(
-		const gravm_runstack_callback_t *cb,
-		int max_stack_size,
-		int framedata_size)
+static int heap_push(
+		gravm_runstack_t *self,
+		int index)
 {
-	gravm_runstack_t *rs;
+	int *heap;
+	int capacity;
+	int pos;
+	int parent;
 
-	assert(cb->init != NULL);
-
-	rs = calloc(1, sizeof(*rs));
-	if(rs == NULL) {
-		errno = -ENOMEM;
-		return NULL;
+	if(self->n_heap == self->heap_capacity) {
+		capacity = self->heap_capacity == 0 ? 64 : self->heap_capacity * 2;
+		heap = realloc(self->heap, sizeof(int) * capacity);
+		if(heap == NULL)
+			return -ENOMEM;
+		self->heap = heap;
+		self->heap_capacity = capacity;
 	}
-
-	rs->edges = btree_new(GRAVM_BTREE_ORDER, sizeof(edge_entry_t), cb_cmp, BTREE_OPT_DEFAULT);
-	if(rs->edges == NULL) {
-		free(rs);
-		return NULL;
+	for(pos = self->n_heap++; pos > 0; pos = parent) {
+		parent = (pos - 1) / 2;
+		if(!heap_less(self, index, self->heap[parent]))
+			break;
+		self->heap[pos] = self->heap[parent];
 	}
-	btree_set_group_default(rs->edges, cmp_full);
-
-	rs->framedata_size = framedata_size;
-	rs->cb = cb;
-	rs->max_stack_size = max_stack_size;
-	rs->state = GRAVM_RS_STATE_CREATED;
-
-	return rs;
+	self->heap[pos] = index;
+	return 0;
 }
 
-void gravm_runstack_destroy(
+static int heap_pop(
 		gravm_runstack_t *self)
 {
-	stackframe_t *cur;
-	stackframe_t *old;
+	int top = self->heap[0];
+	int last = self->heap[--self->n_heap];
+	int pos = 0;
+	int child;
 
-	if(self->cb->destroy != NULL)
-		self->cb->destroy(self->user);
-	cur = self->trash;
-	while(cur != NULL) {
-		old = cur;
-		cur = cur->prev;
-		free(old);
-	}
-	cur = self->top;
-	while(cur != NULL) {
-		old = cur;
-		cur = cur->prev;
-		free(old);
+	while((child = 2 * pos + 1) < self->n_heap) {
+		if(child + 1 < self->n_heap && heap_less(self, self->heap[child + 1], self->heap[child]))
+			child++;
+		if(!heap_less(self, self->heap[child], last))
+			break;
+		self->heap[pos] = self->heap[child];
+		pos = child;
 	}
-	btree_destroy(self->edges);
-	free(self);
+	self->heap[pos] = last;
+	return top;
 }
 
-int gravm_runstack_prepare(
+/* completes the frame and all ancestors whose children are completed by that */
+static int priority_settle(
 		gravm_runstack_t *self,
-		void *user)
+		int index)
 {
-	int n;
-	int i;
 	int ret;
-	edge_entry_t entry;
-	btree_it_t it;
-	edge_entry_t *cur;
-	gravm_runstack_edgedef_t def;
-
-	self->state = GRAVM_RS_STATE_CREATED;
-	while(self->top != NULL)
-		pop(self);
-	btree_clear(self->edges);
-	self->user = user;
-	n = self->cb->init(self->user);
-	if(n < 0)
-		return n;
 
-	for(i = 0; i < n; i++) {
-		memset(&def, 0, sizeof(def));
-		ret = self->cb->structure(self->user, i, &def);
-		if(ret < 0)
-			return ret;
-		if(def.target == GRAVM_RS_ROOT)
-			return -EINVAL;
-		entry.id = i;
-		entry.source = def.source;
-		entry.priority = def.priority;
-		entry.target = def.target;
-
-		ret = btree_insert(self->edges, &entry);
-		if(ret < 0)
+	while(index >= 0 && level_frame(self, index)->pending == 0) {
+		ret = level_complete(self, index);
+		if(ret != GRAVM_RS_SUCCESS)
 			return ret;
+		index = level_frame(self, index)->parent;
+		if(index >= 0)
+			level_frame(self, index)->pending--;
 	}
-
-	entry.source = GRAVM_RS_ROOT;
-	self->root_lower = btree_find_lower_group(self->edges, &entry, cmp_source, &it);
-	self->root_upper = btree_find_upper_group(self->edges, &entry, cmp_source, NULL);
-	assert(self->root_lower >= 0);
-	assert(self->root_upper >= 0);
-	if(self->root_lower == self->root_upper) /* missing root edges */
-		return -ENOENT;
-
-	for(/* it initialized above */; it.index < btree_size(self->edges); btree_iterate_next(&it)) {
-		cur = it.element;
-
-		/* boundaries of outgoing edges */
-		entry.source = cur->target;
-		cur->out_lower = btree_find_lower_group(self->edges, &entry, cmp_source, NULL);
-		cur->out_upper = btree_find_upper_group(self->edges, &entry, cmp_source, NULL);
-		assert(cur->out_upper >= cur->out_lower);
-
-		/* boundaries of pre- and post-outgoing edges (priority < 0/>= 0) */
-		entry.priority = -1;
-		cur->out_boundary = btree_find_upper_group(self->edges, &entry, cmp_priority, NULL);
-	}
-
-	self->state = GRAVM_RS_STATE_PREPARED;
-
-	return 0;
+	return GRAVM_RS_SUCCESS;
 }
 
-int gravm_runstack_suspend(
+static int run_priority(
 		gravm_runstack_t *self)
 {
-	self->suspended = true;
+	int index;
+	int first;
+	int ret;
+	int i;
+
+	ret = level_start(self);
+	if(ret != GRAVM_RS_TRUE)
+		return ret;
+	self->n_heap = 0;
+	for(i = 0; i < self->n_level_frames; i++) {
+		ret = heap_push(self, i);
+		if(ret < 0) {
+			errno = ret;
+			return level_abort(self, GRAVM_RS_FATAL);
+		}
+	}
+
+	while(self->n_heap > 0) {
+		index = heap_pop(self);
+		ret = level_enter(self, index);
+		if(ret == GRAVM_RS_SUCCESS)
+			ret = level_run_node(self, index);
+		if(ret == GRAVM_RS_SUCCESS && level_frame(self, index)->progress == LEVEL_RAN) {
+			first = self->n_level_frames;
+			ret = level_expand(self, index);
+			for(i = first; i < self->n_level_frames && ret == GRAVM_RS_SUCCESS; i++)
+				if(heap_push(self, i) < 0) {
+					errno = -ENOMEM;
+					ret = GRAVM_RS_FATAL;
+				}
+		}
+		if(ret == GRAVM_RS_SUCCESS)
+			ret = priority_settle(self, index);
+		if(ret != GRAVM_RS_SUCCESS)
+			return level_abort(self, ret);
+	}
+	self->cb_edge = NULL;
+	self->state = GRAVM_RS_STATE_EXECUTED;
 	return GRAVM_RS_SUCCESS;
 }
 
-int gravm_runstack_run(
-		gravm_runstack_t *self)
+/* pushes the first (or next) root edge, or start edge in case of gravm_runstack_run_from(). returns GRAVM_RS_TRUE
+ * if an edge has been pushed, GRAVM_RS_FALSE if there are no edges left and a negative error code otherwise */
+static int push_start(
+		gravm_runstack_t *self,
+		bool first)
 {
+	const range_t *root;
+	const edge_entry_t *edge;
 	int ret;
-	self->suspended = false;
 
-	while(true) {
-		ret = gravm_runstack_step(self);
-		switch(ret) {
-			case GRAVM_RS_TRUE:
-				break;
-			case GRAVM_RS_FALSE:
-				return GRAVM_RS_SUCCESS;
-			default:
-				return ret;
-		}
-		if(self->suspended)
-			return GRAVM_RS_SUSPENDED;
+	if(self->starting) {
+		if(first)
+			self->start_pos = 0;
+		do {
+			if(self->start_pos == self->n_start)
+				return GRAVM_RS_FALSE;
+			edge = program_edge(self->program, self->start[self->start_pos++]);
+		} while(!edge_enabled(self, edge));
 	}
+	else if(first) {
+		root = program_node(self->program, GRAVM_RS_ROOT);
+		if(root->lower >= root->upper)
+			return -ENOENT;
+		else if(!it_begin_enabled(self, &self->root_it, self->program, false, root->lower, root->upper))
+			return GRAVM_RS_FALSE;
+		edge = it_element(self, &self->root_it);
+	}
+	else if(it_next(&self->root_it))
+		edge = it_element(self, &self->root_it);
+	else
+		return GRAVM_RS_FALSE;
+
+	ret = push(self, edge, self->program);
+	if(ret < 0)
+		return ret;
+	return GRAVM_RS_TRUE;
 }
 
 int gravm_runstack_step(
@@ -1089,55 +2782,61 @@ int gravm_runstack_step(
 	while(!self->invoked) {
 		switch(self->state) {
 			case GRAVM_RS_STATE_PREPARED:
+				if((self->options & (GRAVM_RS_OPT_LEVEL_ORDER | GRAVM_RS_OPT_PRIORITY)) != 0) {
+					errno = -ENOTSUP;
+					return GRAVM_RS_FATAL;
+				}
 				self->state = GRAVM_RS_STATE_EXECUTING;
 				self->stack_size = 0;
-
-				if(!it_begin(self->edges, &self->root_it, self->root_lower, self->root_upper)) {
+				ret = begin_run(self);
+				if(ret < 0) {
 					self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
-					errno = -ENOENT;
+					errno = ret;
 					return GRAVM_RS_FATAL;
 				}
-				ret = push(self, self->root_it.it.element);
+
+				ret = push_start(self, true);
 				if(ret < 0) {
 					self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
+					errno = ret;
 					return GRAVM_RS_FATAL;
 				}
+				else if(ret == GRAVM_RS_FALSE) { /* all start edges disabled */
+					self->state = GRAVM_RS_STATE_EXECUTED;
+					return GRAVM_RS_FALSE;
+				}
 				break;
 			case GRAVM_RS_STATE_EXECUTING:
 				if(self->top == NULL) {
-					if(it_next(&self->root_it)) {
-						ret = push(self, self->root_it.it.element);
-						if(ret < 0) {
-							self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
-							return GRAVM_RS_FATAL;
-						}
+					ret = push_start(self, false);
+					if(ret < 0) {
+						self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
+						errno = ret;
+						return GRAVM_RS_FATAL;
 					}
-					else {
+					else if(ret == GRAVM_RS_FALSE) {
 						self->state = GRAVM_RS_STATE_EXECUTED;
 						return GRAVM_RS_FALSE;
 					}
 				}
+				if(self->parking && self->top->ip == GRAVM_RS_IP_NODE_RUN)
+					return LANE_PARKED;
+				TRACE_STEP(self)
 				step_exec[self->top->ip](self);
 				if(self->state == GRAVM_RS_STATE_EXECUTED_ERROR)
 					return GRAVM_RS_FATAL;
 				break;
 			case GRAVM_RS_STATE_THROWING:
-				if(self->top == NULL) {
-					if(it_next(&self->root_it)) {
-						ret = push(self, self->root_it.it.element);
-						if(ret < 0) {
-							self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
-							return GRAVM_RS_FATAL;
-						}
-					}
-					else {
-						if(self->throw_code == 0)
-							self->state = GRAVM_RS_STATE_EXECUTED;
-						else
-							self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
-						return GRAVM_RS_THROW;
-					}
+				while(self->top != NULL && !observes_throw(self, self->top))
+					pop(self);
+				if(self->top == NULL) { /* remaining root edges would be popped right after being pushed */
+					if(self->throw_code == 0)
+						self->state = GRAVM_RS_STATE_EXECUTED;
+					else
+						self->state = GRAVM_RS_STATE_EXECUTED_ERROR;
+					return GRAVM_RS_THROW;
 				}
+				TRACE_STEP(self)
 				step_throw[self->top->ip](self);
 				if(self->state == GRAVM_RS_STATE_EXECUTED_ERROR)
 					return GRAVM_RS_FATAL;
@@ -1455,9 +3154,8 @@ void gravm_runstack_dump(
 		void (*print_edge)(FILE *f, void *user, int id),
 		void (*print_node)(FILE *f, void *user, int id))
 {
-	btree_it_t it;
-	edge_entry_t *edge;
-	int ret;
+	const edge_entry_t *edge;
+	int i;
 
 	printf("---------------------------- DUMP RUNSTACK ---------------------\n");
 	printf("state: ");
@@ -1486,11 +3184,10 @@ void gravm_runstack_dump(
 	}
 	printf("\n");
 	printf("edges:\n");
-	ret = btree_find_at(self->edges, 0, &it);
-	if(ret < 0)
-		printf("  (error)\n");
-	else do {
-		edge = it.element;
+	if(self->program == NULL || program_commit(self->program) < 0)
+		printf("  (not prepared)\n");
+	else for(i = 0; i < self->program->n_edges; i++) {
+		edge = program_edge(self->program, i);
 		printf("  ");
 		if(print_edge == NULL)
 			printf("%d", edge->id);
@@ -1509,7 +3206,7 @@ void gravm_runstack_dump(
 		else
 			print_node(stdout, self->user, edge->target);
 		printf("\n");
-	} while(btree_iterate_next(&it) < btree_size(self->edges));
+	}
 	printf("\n");
 	stackframe_t *cur = self->top;
 	printf("stack (top to bottom):\n");
@@ -1528,5 +3225,6 @@ void gravm_runstack_dump(
 
 #ifdef TESTING
 #include "../test/runstack.h"
+#include "../test/modes.h"
 #endif
 
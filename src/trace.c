@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <string.h>
+#include <stdbool.h>
+#include <assert.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <stdatomic.h>
+#include <time.h>
+
+#include "config.h"
+#include "trace_private.h"
+
+#include <gravm/trace.h>
+
+#define TRACE_LINE 64 /* keeps producer and consumer indices on separate cache lines */
+
+struct gravm_trace {
+	_Atomic uint64_t head; /* next record to be written; written by the producer only */
+	char pad_head[TRACE_LINE - sizeof(uint64_t)];
+	_Atomic uint64_t tail; /* next record to be read; written by the consumer only */
+	char pad_tail[TRACE_LINE - sizeof(uint64_t)];
+	_Atomic uint64_t dropped;
+	uint64_t mask; /* capacity - 1 */
+	gravm_trace_record_t records[];
+};
+
+gravm_trace_t *gravm_trace_new(
+		int capacity)
+{
+	gravm_trace_t *trace;
+	uint64_t size = 1;
+
+	if(capacity <= 0) {
+		errno = -EINVAL;
+		return NULL;
+	}
+	while(size < capacity)
+		size *= 2;
+	trace = calloc(1, sizeof(*trace) + sizeof(gravm_trace_record_t) * size);
+	if(trace == NULL) {
+		errno = -ENOMEM;
+		return NULL;
+	}
+	atomic_init(&trace->head, 0);
+	atomic_init(&trace->tail, 0);
+	atomic_init(&trace->dropped, 0);
+	trace->mask = size - 1;
+	return trace;
+}
+
+void gravm_trace_destroy(
+		gravm_trace_t *self)
+{
+	free(self);
+}
+
+void trace_write(
+		gravm_trace_t *self,
+		int lane,
+		int edge,
+		int node,
+		int ip,
+		int state)
+{
+	uint64_t head = atomic_load_explicit(&self->head, memory_order_relaxed);
+	uint64_t tail = atomic_load_explicit(&self->tail, memory_order_acquire);
+	gravm_trace_record_t *record;
+	struct timespec now;
+
+	if(head - tail > self->mask) {
+		atomic_fetch_add_explicit(&self->dropped, 1, memory_order_relaxed);
+		return;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	record = self->records + (head & self->mask);
+	record->time = (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+	record->lane = lane;
+	record->edge = edge;
+	record->node = node;
+	record->ip = ip;
+	record->state = state;
+	atomic_store_explicit(&self->head, head + 1, memory_order_release);
+}
+
+int gravm_trace_read(
+		gravm_trace_t *self,
+		gravm_trace_record_t *records,
+		int n)
+{
+	uint64_t tail = atomic_load_explicit(&self->tail, memory_order_relaxed);
+	uint64_t head = atomic_load_explicit(&self->head, memory_order_acquire);
+	uint64_t avail = head - tail;
+	int i;
+
+	if(n < 0)
+		return -EINVAL;
+	else if(avail < (uint64_t)n)
+		n = (int)avail;
+	for(i = 0; i < n; i++)
+		records[i] = self->records[(tail + i) & self->mask];
+	atomic_store_explicit(&self->tail, tail + n, memory_order_release);
+	return n;
+}
+
+uint64_t gravm_trace_dropped(
+		gravm_trace_t *self)
+{
+	return atomic_load_explicit(&self->dropped, memory_order_relaxed);
+}
+
+#ifdef TESTING
+#include "../test/trace.h"
+#endif
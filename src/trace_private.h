@@ -0,0 +1,12 @@
+#pragma once
+
+#include <gravm/trace.h>
+
+/* producer side: appends a record unless the ring is full */
+void trace_write(
+		gravm_trace_t *self,
+		int lane,
+		int edge,
+		int node,
+		int ip,
+		int state);
@@ -0,0 +1,270 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+#include <gravm/program.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(X) (sizeof(X) / sizeof(*(X)))
+#endif
+
+#define CACHE_TEST_DATA_SIZE 100
+
+typedef struct {
+	int input; /* copied from the parent frame */
+	int result; /* node result plus the results of all children */
+} cache_test_frame_t;
+
+/* chain 1 -> 2 -> 3 */
+static const gravm_runstack_edgedef_t cache_test_edges[] = {
+	{ .source = GRAVM_RS_ROOT, .target = 1, .priority = 0 },
+	{ .source = 1, .target = 2, .priority = 0 },
+	{ .source = 2, .target = 3, .priority = 0 }
+};
+
+typedef struct {
+	int n_node_run;
+	int total; /* result of the root edge */
+} cache_test_context_t;
+
+static int cb_cache_test_init(
+		void *data)
+{
+	return ARRAY_SIZE(cache_test_edges);
+}
+
+static int cb_cache_test_structure(
+		void *data,
+		int edge,
+		gravm_runstack_edgedef_t *def)
+{
+	*def = cache_test_edges[edge];
+	return 0;
+}
+
+static int cb_cache_test_descend(
+		void *data,
+		int edge,
+		void *parent_,
+		void *child_)
+{
+	cache_test_frame_t *parent = parent_;
+	cache_test_frame_t *child = child_;
+
+	child->input = parent == NULL ? 7 : parent->input;
+	child->result = 0;
+	return GRAVM_RS_TRUE;
+}
+
+static int cb_cache_test_ascend(
+		void *data,
+		int edge,
+		bool throwing,
+		int err,
+		void *parent_,
+		void *child_)
+{
+	cache_test_context_t *ctx = data;
+	cache_test_frame_t *parent = parent_;
+	cache_test_frame_t *child = child_;
+
+	if(parent == NULL)
+		ctx->total = child->result;
+	else
+		parent->result += child->result;
+	return GRAVM_RS_SUCCESS;
+}
+
+static int cb_cache_test_node_run(
+		void *data,
+		int id,
+		void *frame_)
+{
+	cache_test_context_t *ctx = data;
+	cache_test_frame_t *frame = frame_;
+
+	ctx->n_node_run++;
+	frame->result += frame->input * 10 + id;
+	return GRAVM_RS_TRUE;
+}
+
+static int cb_cache_test_fingerprint(
+		void *data,
+		int edge,
+		const void *parent_,
+		uint64_t *fingerprint)
+{
+	const cache_test_frame_t *parent = parent_;
+	*fingerprint = parent->input;
+	return GRAVM_RS_TRUE;
+}
+
+static void cache_test_lookup_store()
+{
+	char data[CACHE_TEST_DATA_SIZE];
+	char out[CACHE_TEST_DATA_SIZE];
+	unsigned long hits;
+	unsigned long misses;
+	gravm_cache_t *cache;
+
+	cache = gravm_cache_new(1024 * 1024);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(cache);
+	memset(data, 'a', sizeof(data));
+
+	CU_ASSERT_FALSE(cache_lookup(cache, 1, 0, 1, 42, out, sizeof(out)));
+	CU_ASSERT_EQUAL(cache_store(cache, 1, 0, 1, 42, data, sizeof(data)), 0);
+	CU_ASSERT_TRUE(cache_lookup(cache, 1, 0, 1, 42, out, sizeof(out)));
+	CU_ASSERT(memcmp(data, out, sizeof(data)) == 0);
+	CU_ASSERT_FALSE(cache_lookup(cache, 1, 0, 2, 42, out, sizeof(out)));
+	CU_ASSERT_FALSE(cache_lookup(cache, 1, 0, 1, 43, out, sizeof(out)));
+	CU_ASSERT_FALSE(cache_lookup(cache, 2, 0, 1, 42, out, sizeof(out))); /* same edge of another program */
+	CU_ASSERT_FALSE(cache_lookup(cache, 1, 5, 1, 42, out, sizeof(out))); /* same edge with an edge mask */
+	CU_ASSERT_FALSE(cache_lookup(cache, 1, 0, 1, 42, out, sizeof(out) - 1));
+
+	/* replace */
+	memset(data, 'b', sizeof(data));
+	CU_ASSERT_EQUAL(cache_store(cache, 1, 0, 1, 42, data, sizeof(data)), 0);
+	CU_ASSERT_TRUE(cache_lookup(cache, 1, 0, 1, 42, out, sizeof(out)));
+	CU_ASSERT_EQUAL(out[0], 'b');
+	CU_ASSERT_EQUAL(gravm_cache_bytes(cache), entry_bytes(sizeof(data)));
+
+	gravm_cache_stats(cache, &hits, &misses);
+	CU_ASSERT_EQUAL(hits, 2);
+	CU_ASSERT_EQUAL(misses, 6);
+
+	gravm_cache_clear(cache);
+	CU_ASSERT_EQUAL(gravm_cache_bytes(cache), 0);
+	CU_ASSERT_FALSE(cache_lookup(cache, 1, 0, 1, 42, out, sizeof(out)));
+	gravm_cache_destroy(cache);
+}
+
+static void cache_test_eviction()
+{
+	char data[CACHE_TEST_DATA_SIZE];
+	gravm_cache_t *cache;
+	int i;
+
+	memset(data, 0, sizeof(data));
+	cache = gravm_cache_new(3 * entry_bytes(sizeof(data)));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(cache);
+	CU_ASSERT_EQUAL(cache_store(cache, 1, 0, 0, 0, data, 3 * entry_bytes(sizeof(data))), -E2BIG);
+
+	for(i = 0; i < 3; i++)
+		CU_ASSERT_EQUAL(cache_store(cache, 1, 0, i, 0, data, sizeof(data)), 0);
+	CU_ASSERT_TRUE(cache_lookup(cache, 1, 0, 0, 0, data, sizeof(data)));
+
+	/* entry 0 has been referenced and gets a second chance, entry 1 is evicted instead */
+	CU_ASSERT_EQUAL(cache_store(cache, 1, 0, 3, 0, data, sizeof(data)), 0);
+	CU_ASSERT_TRUE(gravm_cache_bytes(cache) <= 3 * entry_bytes(sizeof(data)));
+	CU_ASSERT_TRUE(cache_lookup(cache, 1, 0, 0, 0, data, sizeof(data)));
+	CU_ASSERT_FALSE(cache_lookup(cache, 1, 0, 1, 0, data, sizeof(data)));
+	CU_ASSERT_TRUE(cache_lookup(cache, 1, 0, 2, 0, data, sizeof(data)));
+	CU_ASSERT_TRUE(cache_lookup(cache, 1, 0, 3, 0, data, sizeof(data)));
+
+	/* many entries, forcing rehashes and evictions */
+	for(i = 0; i < 10000; i++)
+		CU_ASSERT_EQUAL(cache_store(cache, 1, 0, i, i * 31, data, sizeof(data)), 0);
+	CU_ASSERT_TRUE(gravm_cache_bytes(cache) <= 3 * entry_bytes(sizeof(data)));
+	CU_ASSERT_TRUE(cache_lookup(cache, 1, 0, 9999, 9999 * 31, data, sizeof(data)));
+
+	gravm_cache_destroy(cache);
+}
+
+static void cache_test_runstack()
+{
+	static const uint64_t mask[] = { (1 << 0) | (1 << 1) }; /* disables 2 -> 3 */
+	gravm_runstack_callback_t cb;
+	cache_test_context_t ctx;
+	gravm_program_t *program;
+	gravm_runstack_t *rs[2];
+	gravm_runstack_t *other;
+	gravm_cache_t *cache;
+	int i;
+
+	memset(&cb, 0, sizeof(cb));
+	cb.init = cb_cache_test_init;
+	cb.structure = cb_cache_test_structure;
+	cb.descend = cb_cache_test_descend;
+	cb.ascend = cb_cache_test_ascend;
+	cb.node_run = cb_cache_test_node_run;
+	cb.fingerprint = cb_cache_test_fingerprint;
+
+	cache = gravm_cache_new(64 * 1024);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(cache);
+	memset(&ctx, 0, sizeof(ctx));
+	program = gravm_program_new(&cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	for(i = 0; i < ARRAY_SIZE(rs); i++) {
+		rs[i] = gravm_runstack_new(&cb, -1, sizeof(cache_test_frame_t));
+		CU_ASSERT_PTR_NOT_NULL_FATAL(rs[i]);
+		CU_ASSERT_EQUAL(gravm_runstack_set_cache(rs[i], cache), 0);
+		CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare_program(rs[i], program, &ctx), 0);
+	}
+
+	/* first run executes everything */
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs[0]), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.n_node_run, 3);
+	CU_ASSERT_EQUAL(ctx.total, 71 + 72 + 73);
+
+	/* second runstack shares the program and the cache: the root edge is not cacheable, its outgoing edge is */
+	ctx.n_node_run = 0;
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs[1]), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.n_node_run, 1);
+	CU_ASSERT_EQUAL(ctx.total, 71 + 72 + 73);
+
+	/* with an edge mask, the entries stored without one are not used */
+	CU_ASSERT_EQUAL(gravm_runstack_set_edge_mask(rs[1], mask), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs[1]), 0);
+	ctx.n_node_run = 0;
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs[1]), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.n_node_run, 2);
+	CU_ASSERT_EQUAL(ctx.total, 71 + 72);
+
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs[1]), 0);
+	ctx.n_node_run = 0;
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs[1]), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.n_node_run, 1);
+	CU_ASSERT_EQUAL(ctx.total, 71 + 72);
+
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs[0]), 0);
+	ctx.n_node_run = 0;
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs[0]), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.n_node_run, 1);
+	CU_ASSERT_EQUAL(ctx.total, 71 + 72 + 73);
+
+	/* a separately compiled program with the same edge ids does not see the entries */
+	other = gravm_runstack_new(&cb, -1, sizeof(cache_test_frame_t));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(other);
+	CU_ASSERT_EQUAL(gravm_runstack_set_cache(other, cache), 0);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(other, &ctx), 0);
+	ctx.n_node_run = 0;
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(other), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.n_node_run, 3);
+	CU_ASSERT_EQUAL(ctx.total, 71 + 72 + 73);
+
+	gravm_runstack_destroy(other);
+	for(i = 0; i < ARRAY_SIZE(rs); i++)
+		gravm_runstack_destroy(rs[i]);
+	gravm_program_destroy(program);
+	gravm_cache_destroy(cache);
+}
+
+int gravmtest_cache()
+{
+	CU_pSuite suite;
+	CU_pTest test;
+
+	BEGIN_SUITE("Cache", NULL, NULL);
+		ADD_TEST("lookup and store", cache_test_lookup_store);
+		ADD_TEST("eviction", cache_test_eviction);
+		ADD_TEST("memoized subgraphs", cache_test_runstack);
+	END_SUITE;
+
+	return 0;
+}
@@ -4,6 +4,10 @@
 #include <gravm/runstack.h>
 
 int gravmtest_runstack();
+int gravmtest_program();
+int gravmtest_modes();
+int gravmtest_cache();
+int gravmtest_trace();
 
 static int sbcb_init(
 		void *data)
@@ -96,6 +100,30 @@ int main(
 			return ret;
 		}
 
+		ret = gravmtest_program();
+		if(ret != 0) {
+			CU_cleanup_registry();
+			return ret;
+		}
+
+		ret = gravmtest_modes();
+		if(ret != 0) {
+			CU_cleanup_registry();
+			return ret;
+		}
+
+		ret = gravmtest_cache();
+		if(ret != 0) {
+			CU_cleanup_registry();
+			return ret;
+		}
+
+		ret = gravmtest_trace();
+		if(ret != 0) {
+			CU_cleanup_registry();
+			return ret;
+		}
+
 		CU_basic_set_mode(CU_BRM_VERBOSE);
 		CU_basic_run_tests();
 		ret = CU_get_error();
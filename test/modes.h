@@ -0,0 +1,1305 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(X) (sizeof(X) / sizeof(*(X)))
+#endif
+
+#define MODES_TEST_MAX_TRACE 64
+#define MODES_TEST_CHAIN 1000
+
+enum {
+	MODES_CALL_NODE_RUN,
+	MODES_CALL_NODE_REVISIT,
+	MODES_CALL_NODE_RUN_BATCH, /* id: number of nodes */
+	MODES_CALL_ASCEND, /* id: edge */
+	MODES_CALL_EDGES_PREPARE, /* one per edge id */
+	MODES_CALL_EDGES_UNPREPARE,
+	MODES_CALL_EDGES_ABORT
+};
+
+typedef struct {
+	int call;
+	int id;
+} modes_test_call_t;
+
+/* diamond: 1 -> {2, 3} -> 4 -> 5 */
+static const gravm_runstack_edgedef_t modes_test_diamond[] = {
+	{ .source = GRAVM_RS_ROOT, .target = 1, .priority = 0 },
+	{ .source = 1, .target = 2, .priority = 0 },
+	{ .source = 1, .target = 3, .priority = 1 },
+	{ .source = 2, .target = 4, .priority = 0 },
+	{ .source = 3, .target = 4, .priority = 0 },
+	{ .source = 4, .target = 5, .priority = 0 }
+};
+
+typedef struct {
+	const gravm_runstack_edgedef_t *edges;
+	int n_edges;
+	modes_test_call_t trace[MODES_TEST_MAX_TRACE];
+	int n_trace;
+	int total; /* sum of the node ids run below the root edges, see cb_modes_test_ascend() */
+	int throw_at; /* node_run throws for this node; 0: never */
+	gravm_runstack_t *rs; /* for callbacks calling back into the runstack */
+	int emit_result; /* result of gravm_runstack_emit() for an unknown target */
+} modes_test_context_t;
+
+/* chain of levels: 1 -> {2, 3}, 2 -> {6 (pre), 4}, 3 -> 5 */
+static const gravm_runstack_edgedef_t modes_test_wide[] = {
+	{ .source = GRAVM_RS_ROOT, .target = 1, .priority = 0 },
+	{ .source = 1, .target = 2, .priority = 0 },
+	{ .source = 1, .target = 3, .priority = 1 },
+	{ .source = 2, .target = 4, .priority = 0 },
+	{ .source = 3, .target = 5, .priority = 0 },
+	{ .source = 2, .target = 6, .priority = -1 }
+};
+
+static gravm_runstack_callback_t modes_test_cb;
+
+static void modes_test_record(
+		modes_test_context_t *ctx,
+		int call,
+		int id)
+{
+	if(ctx->n_trace == MODES_TEST_MAX_TRACE)
+		return;
+	ctx->trace[ctx->n_trace].call = call;
+	ctx->trace[ctx->n_trace].id = id;
+	ctx->n_trace++;
+}
+
+static int cb_modes_test_init(
+		void *data)
+{
+	modes_test_context_t *ctx = data;
+	return ctx->n_edges;
+}
+
+static int cb_modes_test_structure(
+		void *data,
+		int edge,
+		gravm_runstack_edgedef_t *def)
+{
+	modes_test_context_t *ctx = data;
+	*def = ctx->edges[edge];
+	return 0;
+}
+
+static int cb_modes_test_node_run(
+		void *data,
+		int id,
+		void *frame)
+{
+	modes_test_context_t *ctx = data;
+
+	modes_test_record(ctx, MODES_CALL_NODE_RUN, id);
+	if(id == ctx->throw_at) {
+		errno = -EIO;
+		return GRAVM_RS_THROW;
+	}
+	return GRAVM_RS_TRUE;
+}
+
+static int cb_modes_test_node_revisit(
+		void *data,
+		int id,
+		void *frame)
+{
+	modes_test_record(data, MODES_CALL_NODE_REVISIT, id);
+	return GRAVM_RS_SUCCESS;
+}
+
+/* frames are a single int: sum of the ids of the node and all nodes below */
+static int cb_modes_test_node_run_sum(
+		void *data,
+		int id,
+		void *frame)
+{
+	modes_test_record(data, MODES_CALL_NODE_RUN, id);
+	*(int*)frame += id;
+	return GRAVM_RS_TRUE;
+}
+
+static int cb_modes_test_node_run_batch(
+		void *data,
+		int n,
+		const int *ids,
+		void *const *frames,
+		int *results)
+{
+	int i;
+
+	modes_test_record(data, MODES_CALL_NODE_RUN_BATCH, n);
+	for(i = 0; i < n; i++)
+		results[i] = cb_modes_test_node_run_sum(data, ids[i], frames[i]);
+	return GRAVM_RS_SUCCESS;
+}
+
+static int cb_modes_test_node_run_lanes(
+		int n,
+		void *const *users,
+		const int *ids,
+		void *const *frames,
+		int *results)
+{
+	bool thrown = false;
+	int i;
+
+	for(i = 0; i < n; i++)
+		modes_test_record(users[i], MODES_CALL_NODE_RUN_BATCH, n);
+	for(i = 0; i < n; i++) {
+		results[i] = cb_modes_test_node_run(users[i], ids[i], frames[i]);
+		if(results[i] == GRAVM_RS_THROW)
+			thrown = true;
+	}
+	return thrown ? GRAVM_RS_THROW : GRAVM_RS_SUCCESS;
+}
+
+static int cb_modes_test_ascend(
+		void *data,
+		int edge,
+		bool throwing,
+		int err,
+		void *parent,
+		void *child)
+{
+	modes_test_context_t *ctx = data;
+
+	modes_test_record(ctx, MODES_CALL_ASCEND, edge);
+	if(parent != NULL)
+		*(int*)parent += *(int*)child;
+	else
+		ctx->total += *(int*)child;
+	return GRAVM_RS_SUCCESS;
+}
+
+/* two branches below 1: 3 -> 5 has a higher priority than 1 -> 2 */
+static const gravm_runstack_edgedef_t modes_test_priorities[] = {
+	{ .source = GRAVM_RS_ROOT, .target = 1, .priority = 0 },
+	{ .source = 1, .target = 2, .priority = 5 },
+	{ .source = 1, .target = 3, .priority = 1 },
+	{ .source = 2, .target = 4, .priority = -3 },
+	{ .source = 3, .target = 5, .priority = 2 }
+};
+
+/* root -> 1 -> 2 -> ... -> MODES_TEST_CHAIN; edge x leads to node x + 1 */
+static gravm_runstack_edgedef_t *modes_test_chain()
+{
+	gravm_runstack_edgedef_t *edges;
+	int i;
+
+	edges = calloc(MODES_TEST_CHAIN, sizeof(*edges));
+	for(i = 0; edges != NULL && i < MODES_TEST_CHAIN; i++) {
+		edges[i].source = i == 0 ? GRAVM_RS_ROOT : i;
+		edges[i].target = i + 1;
+	}
+	return edges;
+}
+
+static int cb_modes_test_node_run_throw(
+		void *data,
+		int id,
+		void *frame)
+{
+	if(id < MODES_TEST_CHAIN)
+		return GRAVM_RS_TRUE;
+	errno = -EIO;
+	return GRAVM_RS_THROW;
+}
+
+static int cb_modes_test_edge_catch(
+		void *data,
+		int err,
+		int edge,
+		void *frame)
+{
+	modes_test_context_t *ctx = data;
+
+	ctx->total++;
+	return edge == MODES_TEST_CHAIN / 2 ? GRAVM_RS_TRUE : GRAVM_RS_FALSE;
+}
+
+static void modes_test_record_ids(
+		void *data,
+		int call,
+		int n,
+		const int *ids)
+{
+	int i;
+
+	for(i = 0; i < n; i++)
+		modes_test_record(data, call, ids[i]);
+}
+
+static int cb_modes_test_edges_prepare(
+		void *data,
+		int n,
+		const int *ids,
+		void *frame)
+{
+	modes_test_record_ids(data, MODES_CALL_EDGES_PREPARE, n, ids);
+	return GRAVM_RS_SUCCESS;
+}
+
+static int cb_modes_test_edges_unprepare(
+		void *data,
+		int n,
+		const int *ids,
+		void *frame)
+{
+	modes_test_record_ids(data, MODES_CALL_EDGES_UNPREPARE, n, ids);
+	return GRAVM_RS_SUCCESS;
+}
+
+static int cb_modes_test_edges_abort(
+		void *data,
+		int err,
+		int n,
+		const int *ids,
+		void *frame)
+{
+	modes_test_record_ids(data, MODES_CALL_EDGES_ABORT, n, ids);
+	return GRAVM_RS_SUCCESS;
+}
+
+static int cb_modes_test_edge_prepare(
+		void *data,
+		int id,
+		void *frame)
+{
+	modes_test_record(data, MODES_CALL_EDGES_PREPARE, id);
+	return GRAVM_RS_SUCCESS;
+}
+
+static int cb_modes_test_edge_unprepare(
+		void *data,
+		int id,
+		void *frame)
+{
+	modes_test_record(data, MODES_CALL_EDGES_UNPREPARE, id);
+	return GRAVM_RS_SUCCESS;
+}
+
+static int cb_modes_test_edge_abort(
+		void *data,
+		int err,
+		int id,
+		void *frame)
+{
+	modes_test_record(data, MODES_CALL_EDGES_ABORT, id);
+	return GRAVM_RS_SUCCESS;
+}
+
+/* node 1 emits 2 (pre), 3, 4 and 4 again with a higher priority value, out of order */
+static int cb_modes_test_node_enter_emit(
+		void *data,
+		int id,
+		void *frame)
+{
+	modes_test_context_t *ctx = data;
+
+	if(id != 1)
+		return GRAVM_RS_TRUE;
+	if(gravm_runstack_emit(ctx->rs, 10, 3, 0) < 0 ||
+			gravm_runstack_emit(ctx->rs, 11, 2, -1) < 0 ||
+			gravm_runstack_emit(ctx->rs, 12, 4, 5) < 0 ||
+			gravm_runstack_emit(ctx->rs, 13, 4, 0) < 0)
+		return GRAVM_RS_FATAL;
+	ctx->emit_result = gravm_runstack_emit(ctx->rs, 14, 42, 0);
+	return GRAVM_RS_TRUE;
+}
+
+/* 1 -> {2 (pre), 3, 4} */
+static const gravm_runstack_edgedef_t modes_test_fan[] = {
+	{ .source = GRAVM_RS_ROOT, .target = 1, .priority = 0 },
+	{ .source = 1, .target = 2, .priority = -1 },
+	{ .source = 1, .target = 3, .priority = 0 },
+	{ .source = 1, .target = 4, .priority = 1 }
+};
+
+static int cb_modes_test_node_leave_throw(
+		void *data,
+		int id,
+		void *frame)
+{
+	if(id < MODES_TEST_CHAIN)
+		return GRAVM_RS_SUCCESS;
+	errno = -EIO;
+	return GRAVM_RS_THROW;
+}
+
+static int cb_modes_test_node_catch(
+		void *data,
+		int err,
+		int id,
+		void *frame)
+{
+	modes_test_context_t *ctx = data;
+
+	ctx->total++;
+	return GRAVM_RS_TRUE;
+}
+
+static void modes_test_context_init(
+		modes_test_context_t *ctx,
+		const gravm_runstack_edgedef_t *edges,
+		int n_edges)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->edges = edges;
+	ctx->n_edges = n_edges;
+}
+
+static void modes_test_check_trace(
+		const modes_test_context_t *ctx,
+		const modes_test_call_t *expected,
+		int n)
+{
+	int i;
+
+	CU_ASSERT_EQUAL_FATAL(ctx->n_trace, n);
+	for(i = 0; i < n; i++) {
+		CU_ASSERT_EQUAL(ctx->trace[i].call, expected[i].call);
+		CU_ASSERT_EQUAL(ctx->trace[i].id, expected[i].id);
+	}
+}
+
+static void modes_test_visit_once()
+{
+	static const modes_test_call_t expected_all[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_NODE_RUN, 5 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_NODE_RUN, 5 }
+	};
+	static const modes_test_call_t expected_once[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_NODE_RUN, 5 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_REVISIT, 4 }
+	};
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+
+	modes_test_context_init(&ctx, modes_test_diamond, ARRAY_SIZE(modes_test_diamond));
+	rs = gravm_runstack_new(&modes_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_all, ARRAY_SIZE(expected_all));
+
+	/* the visited set is cleared between runs */
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_VISIT_ONCE), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_once, ARRAY_SIZE(expected_once));
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_once, ARRAY_SIZE(expected_once));
+
+	gravm_runstack_destroy(rs);
+}
+
+static void modes_test_incremental()
+{
+	static const modes_test_call_t expected_first[] = { /* 4 -> 5 is retained by the time 4 is entered again */
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_NODE_RUN, 5 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN, 4 }
+	};
+	static const modes_test_call_t expected_dirty_4[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN, 4 }
+	};
+	static const modes_test_call_t expected_dirty_3[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 3 }
+	};
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+
+	modes_test_context_init(&ctx, modes_test_diamond, ARRAY_SIZE(modes_test_diamond));
+	rs = gravm_runstack_new(&modes_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL(gravm_runstack_mark_dirty(rs, 1), -EINVAL);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_INCREMENTAL), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_mark_dirty(rs, 6), -ENOENT);
+	CU_ASSERT_EQUAL(gravm_runstack_mark_dirty(rs, -1), -ENOENT);
+
+	/* nothing retained yet */
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_first, ARRAY_SIZE(expected_first));
+
+	/* nothing dirty */
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.n_trace, 0);
+
+	/* everything leading to 4, but not 4 -> 5 */
+	CU_ASSERT_EQUAL(gravm_runstack_mark_dirty(rs, 4), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_dirty_4, ARRAY_SIZE(expected_dirty_4));
+
+	CU_ASSERT_EQUAL(gravm_runstack_mark_dirty(rs, 3), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_dirty_3, ARRAY_SIZE(expected_dirty_3));
+
+	/* program changes discard the retained frames; without 4 -> 5, a full run matches the run with 4 being dirty */
+	CU_ASSERT_EQUAL(gravm_runstack_edge_remove(rs, 5), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_dirty_4, ARRAY_SIZE(expected_dirty_4));
+
+	gravm_runstack_destroy(rs);
+}
+
+/* retained frames are not reused after the set of enabled edges or the options changed */
+static void modes_test_incremental_mask()
+{
+	static const modes_test_call_t expected_retained[] = {
+		{ MODES_CALL_ASCEND, 0 }
+	};
+	static const modes_test_call_t expected_all[] = {
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_ASCEND, 1 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_ASCEND, 2 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_ASCEND, 3 },
+		{ MODES_CALL_ASCEND, 0 }
+	};
+	static const uint64_t mask[] = { ~((uint64_t)1 << 2) };
+	gravm_runstack_callback_t cb = modes_test_cb;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+
+	cb.node_run = cb_modes_test_node_run_sum;
+	cb.ascend = cb_modes_test_ascend;
+	modes_test_context_init(&ctx, modes_test_fan, ARRAY_SIZE(modes_test_fan));
+	rs = gravm_runstack_new(&cb, -1, sizeof(int));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_INCREMENTAL), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.total, 1 + 2 + 3 + 4);
+
+	/* the root edge is retained */
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_retained, ARRAY_SIZE(expected_retained));
+	CU_ASSERT_EQUAL(ctx.total, 1 + 2 + 3 + 4);
+
+	/* without 1 -> 3 */
+	CU_ASSERT_EQUAL(gravm_runstack_set_edge_mask(rs, mask), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.total, 1 + 2 + 4);
+
+	CU_ASSERT_EQUAL(gravm_runstack_set_edge_mask(rs, NULL), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.total, 1 + 2 + 3 + 4);
+
+	/* incremental execution has been switched off in between */
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, 0), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_INCREMENTAL), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_all, ARRAY_SIZE(expected_all));
+	CU_ASSERT_EQUAL(ctx.total, 1 + 2 + 3 + 4);
+
+	gravm_runstack_destroy(rs);
+}
+
+static void modes_test_level_order()
+{
+	static const modes_test_call_t expected[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN, 6 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_NODE_RUN, 5 },
+		{ MODES_CALL_ASCEND, 4 }, /* reverse order, children before their parents */
+		{ MODES_CALL_ASCEND, 3 },
+		{ MODES_CALL_ASCEND, 5 },
+		{ MODES_CALL_ASCEND, 2 },
+		{ MODES_CALL_ASCEND, 1 },
+		{ MODES_CALL_ASCEND, 0 }
+	};
+	static const modes_test_call_t expected_batch[] = {
+		{ MODES_CALL_NODE_RUN_BATCH, 1 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN_BATCH, 2 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN_BATCH, 3 },
+		{ MODES_CALL_NODE_RUN, 6 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_NODE_RUN, 5 }
+	};
+	static const modes_test_call_t expected_once[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_REVISIT, 4 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_NODE_RUN, 5 }
+	};
+	gravm_runstack_callback_t cb = modes_test_cb;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+
+	cb.node_run = cb_modes_test_node_run_sum;
+	cb.ascend = cb_modes_test_ascend;
+	modes_test_context_init(&ctx, modes_test_wide, ARRAY_SIZE(modes_test_wide));
+	rs = gravm_runstack_new(&cb, -1, sizeof(int));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LEVEL_ORDER), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_step(rs), GRAVM_RS_FATAL);
+	CU_ASSERT_EQUAL(errno, -ENOTSUP);
+
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+	CU_ASSERT_EQUAL(ctx.total, 1 + 2 + 3 + 4 + 5 + 6);
+
+	/* three levels, not enough stack */
+	gravm_runstack_destroy(rs);
+	rs = gravm_runstack_new(&cb, 2, sizeof(int));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LEVEL_ORDER), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_FATAL);
+	CU_ASSERT_EQUAL(errno, -EOVERFLOW);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_state(rs), GRAVM_RS_STATE_EXECUTED_ERROR);
+	gravm_runstack_destroy(rs);
+
+	/* one batch per level */
+	cb.node_run_batch = cb_modes_test_node_run_batch;
+	cb.ascend = NULL;
+	modes_test_context_init(&ctx, modes_test_wide, ARRAY_SIZE(modes_test_wide));
+	rs = gravm_runstack_new(&cb, -1, sizeof(int));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LEVEL_ORDER), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_batch, ARRAY_SIZE(expected_batch));
+	gravm_runstack_destroy(rs);
+
+	/* breadth-first search: node 4 is reached via 2 and 3 on the same level */
+	modes_test_context_init(&ctx, modes_test_diamond, ARRAY_SIZE(modes_test_diamond));
+	rs = gravm_runstack_new(&modes_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LEVEL_ORDER | GRAVM_RS_OPT_VISIT_ONCE), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_once, ARRAY_SIZE(expected_once));
+	gravm_runstack_destroy(rs);
+}
+
+/* a throw in level order aborts every prepared edge and ascends from every frame descended into */
+static void modes_test_level_order_unwind()
+{
+	static const modes_test_call_t expected[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_EDGES_PREPARE, 1 },
+		{ MODES_CALL_EDGES_PREPARE, 2 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_EDGES_PREPARE, 5 },
+		{ MODES_CALL_EDGES_PREPARE, 3 },
+		{ MODES_CALL_EDGES_PREPARE, 4 },
+		{ MODES_CALL_NODE_RUN, 6 }, /* throws, 4 and 5 are not run anymore */
+		{ MODES_CALL_ASCEND, 4 },
+		{ MODES_CALL_ASCEND, 3 },
+		{ MODES_CALL_ASCEND, 5 },
+		{ MODES_CALL_EDGES_ABORT, 4 },
+		{ MODES_CALL_ASCEND, 2 },
+		{ MODES_CALL_EDGES_ABORT, 3 },
+		{ MODES_CALL_EDGES_ABORT, 5 },
+		{ MODES_CALL_ASCEND, 1 },
+		{ MODES_CALL_EDGES_ABORT, 2 },
+		{ MODES_CALL_EDGES_ABORT, 1 },
+		{ MODES_CALL_ASCEND, 0 }
+	};
+	static const modes_test_call_t expected_bulk[] = { /* edges_abort in the order of execution */
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_EDGES_PREPARE, 1 },
+		{ MODES_CALL_EDGES_PREPARE, 2 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_EDGES_PREPARE, 5 },
+		{ MODES_CALL_EDGES_PREPARE, 3 },
+		{ MODES_CALL_EDGES_PREPARE, 4 },
+		{ MODES_CALL_NODE_RUN, 6 },
+		{ MODES_CALL_ASCEND, 4 },
+		{ MODES_CALL_ASCEND, 3 },
+		{ MODES_CALL_ASCEND, 5 },
+		{ MODES_CALL_EDGES_ABORT, 4 },
+		{ MODES_CALL_ASCEND, 2 },
+		{ MODES_CALL_EDGES_ABORT, 5 },
+		{ MODES_CALL_EDGES_ABORT, 3 },
+		{ MODES_CALL_ASCEND, 1 },
+		{ MODES_CALL_EDGES_ABORT, 1 },
+		{ MODES_CALL_EDGES_ABORT, 2 },
+		{ MODES_CALL_ASCEND, 0 }
+	};
+	gravm_runstack_callback_t cb = modes_test_cb;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+	int n_prepared;
+	int n_released;
+	int i;
+	int k;
+
+	cb.ascend = cb_modes_test_ascend;
+	cb.edge_prepare = cb_modes_test_edge_prepare;
+	cb.edge_unprepare = cb_modes_test_edge_unprepare;
+	cb.edge_abort = cb_modes_test_edge_abort;
+	for(k = 0; k < 2; k++) { /* per-edge, then bulk callbacks */
+		if(k == 1) {
+			cb.edges_prepare = cb_modes_test_edges_prepare;
+			cb.edges_unprepare = cb_modes_test_edges_unprepare;
+			cb.edges_abort = cb_modes_test_edges_abort;
+		}
+		modes_test_context_init(&ctx, modes_test_wide, ARRAY_SIZE(modes_test_wide));
+		ctx.throw_at = 6;
+		rs = gravm_runstack_new(&cb, -1, sizeof(int));
+		CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+		CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+		CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LEVEL_ORDER), 0);
+		CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_THROW);
+		CU_ASSERT_EQUAL(gravm_runstack_debug_throw_code(rs), -EIO);
+		CU_ASSERT_EQUAL(gravm_runstack_debug_state(rs), GRAVM_RS_STATE_EXECUTED_ERROR);
+		if(k == 0)
+			modes_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+		else
+			modes_test_check_trace(&ctx, expected_bulk, ARRAY_SIZE(expected_bulk));
+
+		n_prepared = 0;
+		n_released = 0;
+		for(i = 0; i < ctx.n_trace; i++)
+			if(ctx.trace[i].call == MODES_CALL_EDGES_PREPARE)
+				n_prepared++;
+			else if(ctx.trace[i].call == MODES_CALL_EDGES_UNPREPARE || ctx.trace[i].call == MODES_CALL_EDGES_ABORT)
+				n_released++;
+		CU_ASSERT_EQUAL(n_prepared, n_released);
+		gravm_runstack_destroy(rs);
+	}
+}
+
+static void modes_test_priority()
+{
+	static const modes_test_call_t expected[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN, 5 }, /* before 2, although it is one level further down */
+		{ MODES_CALL_ASCEND, 4 },
+		{ MODES_CALL_ASCEND, 2 }, /* 3 is completed as soon as 5 is */
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_ASCEND, 3 },
+		{ MODES_CALL_ASCEND, 1 },
+		{ MODES_CALL_ASCEND, 0 }
+	};
+	gravm_runstack_callback_t cb = modes_test_cb;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+
+	cb.node_run = cb_modes_test_node_run_sum;
+	cb.ascend = cb_modes_test_ascend;
+	modes_test_context_init(&ctx, modes_test_priorities, ARRAY_SIZE(modes_test_priorities));
+	rs = gravm_runstack_new(&cb, -1, sizeof(int));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_PRIORITY), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+	CU_ASSERT_EQUAL(ctx.total, 1 + 2 + 3 + 4 + 5);
+
+	/* runs again after a reset */
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	modes_test_context_init(&ctx, modes_test_priorities, ARRAY_SIZE(modes_test_priorities));
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+	gravm_runstack_destroy(rs);
+}
+
+/* a throw aborts the prepared edges and ascends from the frames not completed yet; the branch of 3 has been
+ * completed before and is left alone */
+static void modes_test_priority_unwind()
+{
+	static const modes_test_call_t expected[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_EDGES_PREPARE, 2 },
+		{ MODES_CALL_EDGES_PREPARE, 1 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_EDGES_PREPARE, 4 },
+		{ MODES_CALL_NODE_RUN, 5 },
+		{ MODES_CALL_ASCEND, 4 },
+		{ MODES_CALL_EDGES_UNPREPARE, 4 },
+		{ MODES_CALL_ASCEND, 2 },
+		{ MODES_CALL_NODE_RUN, 2 }, /* throws */
+		{ MODES_CALL_ASCEND, 1 },
+		{ MODES_CALL_EDGES_ABORT, 1 },
+		{ MODES_CALL_EDGES_ABORT, 2 },
+		{ MODES_CALL_ASCEND, 0 }
+	};
+	gravm_runstack_callback_t cb = modes_test_cb;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+	int n_prepared = 0;
+	int n_released = 0;
+	int i;
+
+	cb.ascend = cb_modes_test_ascend;
+	cb.edge_prepare = cb_modes_test_edge_prepare;
+	cb.edge_unprepare = cb_modes_test_edge_unprepare;
+	cb.edge_abort = cb_modes_test_edge_abort;
+	modes_test_context_init(&ctx, modes_test_priorities, ARRAY_SIZE(modes_test_priorities));
+	ctx.throw_at = 2;
+	rs = gravm_runstack_new(&cb, -1, sizeof(int));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_PRIORITY), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_THROW);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_throw_code(rs), -EIO);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_state(rs), GRAVM_RS_STATE_EXECUTED_ERROR);
+	modes_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+	for(i = 0; i < ctx.n_trace; i++)
+		if(ctx.trace[i].call == MODES_CALL_EDGES_PREPARE)
+			n_prepared++;
+		else if(ctx.trace[i].call == MODES_CALL_EDGES_UNPREPARE || ctx.trace[i].call == MODES_CALL_EDGES_ABORT)
+			n_released++;
+	CU_ASSERT_EQUAL(n_prepared, n_released);
+	gravm_runstack_destroy(rs);
+}
+
+static void modes_test_preallocate()
+{
+	static const gravm_runstack_edgedef_t cycle[] = {
+		{ .source = GRAVM_RS_ROOT, .target = 1, .priority = 0 },
+		{ .source = 1, .target = 2, .priority = 0 },
+		{ .source = 2, .target = 1, .priority = 0 }
+	};
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+
+	modes_test_context_init(&ctx, modes_test_diamond, ARRAY_SIZE(modes_test_diamond));
+	rs = gravm_runstack_new(&modes_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_PREALLOCATE), 0);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_max_depth(rs), 4);
+	CU_ASSERT_EQUAL(rs->n_trash, 4);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(rs->n_trash, 4);
+	gravm_runstack_destroy(rs);
+
+	/* limited by the maximum stack size */
+	rs = gravm_runstack_new(&modes_test_cb, 2, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_PREALLOCATE), 0);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(rs->n_trash, 2);
+	gravm_runstack_destroy(rs);
+
+	/* cycles leave allocation to push() */
+	modes_test_context_init(&ctx, cycle, ARRAY_SIZE(cycle));
+	rs = gravm_runstack_new(&modes_test_cb, 8, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_PREALLOCATE), 0);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_max_depth(rs), -ELOOP);
+	CU_ASSERT_EQUAL(rs->n_trash, 0);
+	gravm_runstack_destroy(rs);
+}
+
+static void modes_test_unwind()
+{
+	gravm_runstack_callback_t cb = modes_test_cb;
+	gravm_runstack_edgedef_t *edges;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+	int ret;
+
+	edges = modes_test_chain();
+	CU_ASSERT_PTR_NOT_NULL_FATAL(edges);
+	cb.node_run = cb_modes_test_node_run_throw;
+	modes_test_context_init(&ctx, edges, MODES_TEST_CHAIN);
+	rs = gravm_runstack_new(&cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+
+	/* nothing observes the exception: the step after the throwing one pops all frames */
+	do
+		ret = gravm_runstack_step(rs);
+	while(ret == GRAVM_RS_TRUE && gravm_runstack_debug_state(rs) == GRAVM_RS_STATE_EXECUTING);
+	CU_ASSERT_EQUAL(ret, GRAVM_RS_TRUE);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_stack_size(rs), MODES_TEST_CHAIN);
+	CU_ASSERT_EQUAL(gravm_runstack_step(rs), GRAVM_RS_THROW);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_stack_size(rs), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_state(rs), GRAVM_RS_STATE_EXECUTED_ERROR);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_throw_code(rs), -EIO);
+	gravm_runstack_destroy(rs);
+
+	/* every frame up to the catching one observes it */
+	cb.edge_catch = cb_modes_test_edge_catch;
+	rs = gravm_runstack_new(&cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.total, MODES_TEST_CHAIN - MODES_TEST_CHAIN / 2);
+	gravm_runstack_destroy(rs);
+
+	/* node_catch only: a frame throwing from node_leave cannot reach it and is popped right away,
+	 * its parent is still iterating its outgoing edges and catches */
+	cb = modes_test_cb;
+	cb.node_leave = cb_modes_test_node_leave_throw;
+	cb.node_catch = cb_modes_test_node_catch;
+	modes_test_context_init(&ctx, edges, MODES_TEST_CHAIN);
+	rs = gravm_runstack_new(&cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	do
+		ret = gravm_runstack_step(rs);
+	while(ret == GRAVM_RS_TRUE && gravm_runstack_debug_state(rs) == GRAVM_RS_STATE_EXECUTING);
+	CU_ASSERT_EQUAL(ret, GRAVM_RS_TRUE);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_stack_size(rs), MODES_TEST_CHAIN);
+	CU_ASSERT_EQUAL(gravm_runstack_step(rs), GRAVM_RS_TRUE);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_stack_size(rs), MODES_TEST_CHAIN - 1);
+	CU_ASSERT_EQUAL(ctx.total, 1);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_state(rs), GRAVM_RS_STATE_EXECUTING);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.total, 1);
+	gravm_runstack_destroy(rs);
+	free(edges);
+}
+
+static void modes_test_bulk_edges()
+{
+	static const modes_test_call_t expected[] = {
+		{ MODES_CALL_EDGES_PREPARE, 1 },
+		{ MODES_CALL_EDGES_PREPARE, 2 },
+		{ MODES_CALL_EDGES_PREPARE, 3 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_EDGES_UNPREPARE, 1 },
+		{ MODES_CALL_EDGES_UNPREPARE, 2 },
+		{ MODES_CALL_EDGES_UNPREPARE, 3 }
+	};
+	static const modes_test_call_t expected_throw[] = {
+		{ MODES_CALL_EDGES_PREPARE, 1 },
+		{ MODES_CALL_EDGES_PREPARE, 2 },
+		{ MODES_CALL_EDGES_PREPARE, 3 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_EDGES_ABORT, 1 },
+		{ MODES_CALL_EDGES_ABORT, 2 },
+		{ MODES_CALL_EDGES_ABORT, 3 }
+	};
+	gravm_runstack_callback_t cb = modes_test_cb;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+
+	cb.edges_prepare = cb_modes_test_edges_prepare;
+	cb.edges_unprepare = cb_modes_test_edges_unprepare;
+	cb.edges_abort = cb_modes_test_edges_abort;
+	modes_test_context_init(&ctx, modes_test_fan, ARRAY_SIZE(modes_test_fan));
+	rs = gravm_runstack_new(&cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	ctx.throw_at = 3;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_THROW);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_throw_code(rs), -EIO);
+	modes_test_check_trace(&ctx, expected_throw, ARRAY_SIZE(expected_throw));
+	gravm_runstack_destroy(rs);
+}
+
+static void modes_test_lazy_prepare()
+{
+	static const modes_test_call_t expected[] = {
+		{ MODES_CALL_EDGES_PREPARE, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_EDGES_UNPREPARE, 1 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_EDGES_PREPARE, 2 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_EDGES_UNPREPARE, 2 },
+		{ MODES_CALL_EDGES_PREPARE, 3 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_EDGES_UNPREPARE, 3 }
+	};
+	static const modes_test_call_t expected_throw[] = {
+		{ MODES_CALL_EDGES_PREPARE, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_EDGES_UNPREPARE, 1 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_EDGES_PREPARE, 2 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_EDGES_ABORT, 2 }
+	};
+	gravm_runstack_callback_t cb = modes_test_cb;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+	int i;
+
+	cb.edge_prepare = cb_modes_test_edge_prepare;
+	cb.edge_unprepare = cb_modes_test_edge_unprepare;
+	cb.edge_abort = cb_modes_test_edge_abort;
+	for(i = 0; i < 2; i++) { /* per-edge, then bulk callbacks */
+		if(i == 1) {
+			cb.edges_prepare = cb_modes_test_edges_prepare;
+			cb.edges_unprepare = cb_modes_test_edges_unprepare;
+			cb.edges_abort = cb_modes_test_edges_abort;
+		}
+		modes_test_context_init(&ctx, modes_test_fan, ARRAY_SIZE(modes_test_fan));
+		rs = gravm_runstack_new(&cb, -1, 0);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+		CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LAZY_PREPARE), 0);
+		CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+		CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+		modes_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+
+		CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+		ctx.n_trace = 0;
+		ctx.throw_at = 3;
+		CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_THROW);
+		modes_test_check_trace(&ctx, expected_throw, ARRAY_SIZE(expected_throw));
+		gravm_runstack_destroy(rs);
+	}
+}
+
+static void modes_test_edge_mask()
+{
+	static const modes_test_call_t expected[] = {
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 4 }
+	};
+	static const modes_test_call_t expected_all[] = {
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN, 4 }
+	};
+	static const modes_test_call_t expected_post[] = {
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 4 }
+	};
+	static const uint64_t mask[] = { ~((uint64_t)1 << 2) };
+	static const uint64_t mask_post[] = { ~((uint64_t)1 << 1 | (uint64_t)1 << 2) };
+	static const uint64_t mask_none[] = { 0 };
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+
+	modes_test_context_init(&ctx, modes_test_fan, ARRAY_SIZE(modes_test_fan));
+	rs = gravm_runstack_new(&modes_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_edge_mask(rs, mask), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+
+	/* swapping the mask does not require preparing again */
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_set_edge_mask(rs, NULL), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_all, ARRAY_SIZE(expected_all));
+
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_set_edge_mask(rs, mask_none), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.n_trace, 0);
+
+	/* disabled pre edge and first post edge, depth first and level order */
+	CU_ASSERT_EQUAL(gravm_runstack_set_edge_mask(rs, mask_post), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_post, ARRAY_SIZE(expected_post));
+
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LEVEL_ORDER), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_post, ARRAY_SIZE(expected_post));
+	gravm_runstack_destroy(rs);
+}
+
+static void modes_test_run_from()
+{
+	static const int start[] = { 3, 2 }; /* 2 -> 4, 1 -> 3 */
+	static const int unknown[] = { 2, 42 };
+	static const int negative[] = { -1 };
+	static const int far[] = { INT_MAX };
+	static const gravm_runstack_edgedef_t add_far = { .source = 4, .target = 6, .priority = 0 };
+	gravm_runstack_callback_t cb = modes_test_cb;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+	int parent = 0;
+
+	cb.node_run = cb_modes_test_node_run_sum;
+	cb.ascend = cb_modes_test_ascend;
+	modes_test_context_init(&ctx, modes_test_diamond, ARRAY_SIZE(modes_test_diamond));
+	rs = gravm_runstack_new(&cb, -1, sizeof(int));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run_from(rs, unknown, ARRAY_SIZE(unknown), &parent), GRAVM_RS_FATAL);
+	CU_ASSERT_EQUAL(errno, -ENOENT);
+
+	CU_ASSERT_EQUAL(gravm_runstack_run_from(rs, start, ARRAY_SIZE(start), &parent), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(parent, (4 + 5) + (3 + 4 + 5));
+	CU_ASSERT_EQUAL(ctx.total, 0);
+	CU_ASSERT_EQUAL(ctx.trace[0].call, MODES_CALL_NODE_RUN);
+	CU_ASSERT_EQUAL(ctx.trace[0].id, 4);
+	CU_ASSERT_EQUAL(gravm_runstack_run_from(rs, start, ARRAY_SIZE(start), &parent), GRAVM_RS_FATAL);
+
+	/* reset forgets the start edges */
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.total, 1 + 2 + 4 + 5 + 3 + 4 + 5);
+
+	/* ids are looked up, not used as table indices */
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, INT_MAX, &add_far), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run_from(rs, negative, ARRAY_SIZE(negative), &parent), GRAVM_RS_FATAL);
+	CU_ASSERT_EQUAL(errno, -ENOENT);
+	parent = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run_from(rs, far, ARRAY_SIZE(far), &parent), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(parent, 6);
+
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LEVEL_ORDER), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run_from(rs, start, ARRAY_SIZE(start), &parent), GRAVM_RS_FATAL);
+	CU_ASSERT_EQUAL(errno, -ENOTSUP);
+	gravm_runstack_destroy(rs);
+}
+
+static void modes_test_emit()
+{
+	static const modes_test_call_t expected[] = {
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_ASCEND, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_ASCEND, 11 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_ASCEND, 2 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_ASCEND, 3 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_ASCEND, 10 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_ASCEND, 13 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_ASCEND, 12 },
+		{ MODES_CALL_ASCEND, 0 }
+	};
+	static const modes_test_call_t expected_masked[] = {
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_ASCEND, 1 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_ASCEND, 11 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_ASCEND, 3 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_ASCEND, 10 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_ASCEND, 13 },
+		{ MODES_CALL_NODE_RUN, 4 },
+		{ MODES_CALL_ASCEND, 12 },
+		{ MODES_CALL_ASCEND, 0 }
+	};
+	const uint64_t mask = (1 << 0) | (1 << 1) | (1 << 3); /* program edge 1 -> 3 disabled */
+	gravm_runstack_callback_t cb = modes_test_cb;
+	modes_test_context_t ctx;
+	gravm_runstack_t *rs;
+	int i;
+
+	cb.node_enter = cb_modes_test_node_enter_emit;
+	cb.node_run = cb_modes_test_node_run_sum;
+	cb.ascend = cb_modes_test_ascend;
+	modes_test_context_init(&ctx, modes_test_fan, ARRAY_SIZE(modes_test_fan));
+	rs = gravm_runstack_new(&cb, -1, sizeof(int));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	ctx.rs = rs;
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_emit(rs, 10, 3, 0), -EINVAL);
+
+	for(i = 0; i < 2; i++) { /* the emitted edges do not outlive the run */
+		CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+		ctx.n_trace = 0;
+		ctx.total = 0;
+		CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+		modes_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+		CU_ASSERT_EQUAL(ctx.total, 2 + 2 + 1 + 3 + 4 + 3 + 4 + 4);
+		CU_ASSERT_EQUAL(ctx.emit_result, -ENOENT);
+	}
+
+	/* the mask only covers the program's edge ids; emitted edges are not affected */
+	CU_ASSERT_EQUAL(gravm_runstack_set_edge_mask(rs, &mask), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	ctx.total = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	modes_test_check_trace(&ctx, expected_masked, ARRAY_SIZE(expected_masked));
+	CU_ASSERT_EQUAL(ctx.total, 2 + 2 + 1 + 4 + 3 + 4 + 4);
+	gravm_runstack_destroy(rs);
+}
+
+static void modes_test_run_batch()
+{
+	static const modes_test_call_t expected[] = {
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN, 4 }
+	};
+	static const modes_test_call_t expected_lanes[] = {
+		{ MODES_CALL_NODE_RUN_BATCH, 5 },
+		{ MODES_CALL_NODE_RUN, 2 },
+		{ MODES_CALL_NODE_RUN_BATCH, 5 },
+		{ MODES_CALL_NODE_RUN, 1 },
+		{ MODES_CALL_NODE_RUN_BATCH, 5 },
+		{ MODES_CALL_NODE_RUN, 3 },
+		{ MODES_CALL_NODE_RUN_BATCH, 5 },
+		{ MODES_CALL_NODE_RUN, 4 }
+	};
+	modes_test_context_t ctx[5];
+	void *users[ARRAY_SIZE(ctx)];
+	int results[ARRAY_SIZE(ctx)];
+	gravm_runstack_callback_t cb;
+	gravm_program_t *program;
+	gravm_runstack_t *rs;
+	int round;
+	int i;
+
+	modes_test_context_init(&ctx[0], modes_test_fan, ARRAY_SIZE(modes_test_fan));
+	program = gravm_program_new(&modes_test_cb, &ctx[0], GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	rs = gravm_runstack_new(&modes_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+
+	for(round = 0; round < 2; round++) { /* the second batch reuses the lanes */
+		for(i = 0; i < ARRAY_SIZE(ctx); i++) {
+			modes_test_context_init(&ctx[i], modes_test_fan, ARRAY_SIZE(modes_test_fan));
+			users[i] = &ctx[i];
+		}
+		ctx[1].throw_at = 3;
+		CU_ASSERT_EQUAL(gravm_runstack_run_batch(rs, program, users, ARRAY_SIZE(ctx) - round, results), GRAVM_RS_SUCCESS);
+		for(i = 0; i < ARRAY_SIZE(ctx) - round; i++) {
+			if(i == 1) {
+				CU_ASSERT_EQUAL(results[i], GRAVM_RS_THROW);
+				CU_ASSERT_EQUAL(ctx[i].n_trace, 3);
+			}
+			else {
+				CU_ASSERT_EQUAL(results[i], GRAVM_RS_SUCCESS);
+				modes_test_check_trace(&ctx[i], expected, ARRAY_SIZE(expected));
+			}
+		}
+	}
+	CU_ASSERT_EQUAL(gravm_runstack_debug_state(rs), GRAVM_RS_STATE_CREATED);
+
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LEVEL_ORDER), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run_batch(rs, program, users, ARRAY_SIZE(ctx), results), GRAVM_RS_FATAL);
+	CU_ASSERT_EQUAL(errno, -ENOTSUP);
+	gravm_runstack_destroy(rs);
+
+	/* lanes in lockstep run each node with a single call; a throw applies to all of them */
+	cb = modes_test_cb;
+	cb.node_run_lanes = cb_modes_test_node_run_lanes;
+	rs = gravm_runstack_new(&cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	for(round = 0; round < 2; round++) {
+		for(i = 0; i < ARRAY_SIZE(ctx); i++) {
+			modes_test_context_init(&ctx[i], modes_test_fan, ARRAY_SIZE(modes_test_fan));
+			users[i] = &ctx[i];
+		}
+		ctx[1].throw_at = round == 0 ? 0 : 3;
+		CU_ASSERT_EQUAL(gravm_runstack_run_batch(rs, program, users, ARRAY_SIZE(ctx), results), GRAVM_RS_SUCCESS);
+		for(i = 0; i < ARRAY_SIZE(ctx); i++) {
+			if(round == 0) {
+				CU_ASSERT_EQUAL(results[i], GRAVM_RS_SUCCESS);
+				modes_test_check_trace(&ctx[i], expected_lanes, ARRAY_SIZE(expected_lanes));
+			}
+			else {
+				CU_ASSERT_EQUAL(results[i], GRAVM_RS_THROW);
+				CU_ASSERT_EQUAL(ctx[i].n_trace, 6);
+			}
+		}
+	}
+	gravm_runstack_destroy(rs);
+	gravm_program_destroy(program);
+}
+
+int gravmtest_modes()
+{
+	CU_pSuite suite;
+	CU_pTest test;
+
+	memset(&modes_test_cb, 0, sizeof(modes_test_cb));
+	modes_test_cb.init = cb_modes_test_init;
+	modes_test_cb.structure = cb_modes_test_structure;
+	modes_test_cb.node_run = cb_modes_test_node_run;
+	modes_test_cb.node_revisit = cb_modes_test_node_revisit;
+
+	BEGIN_SUITE("RunStack Modes", NULL, NULL);
+		ADD_TEST("visit once", modes_test_visit_once);
+		ADD_TEST("incremental", modes_test_incremental);
+		ADD_TEST("incremental with edge mask", modes_test_incremental_mask);
+		ADD_TEST("level order", modes_test_level_order);
+		ADD_TEST("level order unwinding", modes_test_level_order_unwind);
+		ADD_TEST("priority", modes_test_priority);
+		ADD_TEST("priority unwinding", modes_test_priority_unwind);
+		ADD_TEST("preallocation", modes_test_preallocate);
+		ADD_TEST("throw unwinding", modes_test_unwind);
+		ADD_TEST("bulk edge callbacks", modes_test_bulk_edges);
+		ADD_TEST("lazy edge preparation", modes_test_lazy_prepare);
+		ADD_TEST("edge masks", modes_test_edge_mask);
+		ADD_TEST("run from edges", modes_test_run_from);
+		ADD_TEST("emitted edges", modes_test_emit);
+		ADD_TEST("batch execution", modes_test_run_batch);
+	END_SUITE;
+
+	return 0;
+}
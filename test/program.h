@@ -0,0 +1,947 @@
+#include <string.h>
+#include <stdlib.h>
+
+#include "common.h"
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(X) (sizeof(X) / sizeof(*(X)))
+#endif
+
+#define PROGRAM_TEST_MAX_TRACE 32
+
+static const gravm_runstack_edgedef_t program_test_edges[] = {
+	{ .source = GRAVM_RS_ROOT, .target = 1, .priority = 1 },
+	{ .source = 1, .target = 2, .priority = 0 },
+	{ .source = 1, .target = 3, .priority = -1 },
+	{ .source = GRAVM_RS_ROOT, .target = 4, .priority = 0 },
+	{ .source = 3, .target = 2, .priority = 0 }
+};
+
+typedef struct {
+	const gravm_runstack_edgedef_t *edges;
+	int n_edges;
+	int trace[PROGRAM_TEST_MAX_TRACE]; /* node ids passed to node_run() */
+	int n_trace;
+	gravm_runstack_t *rs; /* payload tests only */
+	int payload_checks;
+	int payload_errors;
+} program_test_context_t;
+
+static gravm_runstack_callback_t program_test_cb;
+
+static int cb_program_test_init(
+		void *data)
+{
+	program_test_context_t *ctx = data;
+	return ctx->n_edges;
+}
+
+static int cb_program_test_structure(
+		void *data,
+		int edge,
+		gravm_runstack_edgedef_t *def)
+{
+	program_test_context_t *ctx = data;
+	*def = ctx->edges[edge];
+	return 0;
+}
+
+static int cb_program_test_node_run(
+		void *data,
+		int id,
+		void *frame)
+{
+	program_test_context_t *ctx = data;
+	if(ctx->n_trace < PROGRAM_TEST_MAX_TRACE)
+		ctx->trace[ctx->n_trace++] = id;
+	return GRAVM_RS_TRUE;
+}
+
+static void program_test_context_init(
+		program_test_context_t *ctx)
+{
+	memset(ctx, 0, sizeof(*ctx));
+	ctx->edges = program_test_edges;
+	ctx->n_edges = ARRAY_SIZE(program_test_edges);
+}
+
+/* runs 'program' and stores the sequence of visited nodes in ctx */
+static void program_test_run(
+		gravm_program_t *program,
+		program_test_context_t *ctx)
+{
+	gravm_runstack_t *rs;
+	int ret;
+
+	rs = gravm_runstack_new(&program_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	ret = gravm_runstack_prepare_program(rs, program, ctx);
+	CU_ASSERT_EQUAL(ret, 0);
+	ret = gravm_runstack_run(rs);
+	CU_ASSERT_EQUAL(ret, GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_state(rs), GRAVM_RS_STATE_EXECUTED);
+	gravm_runstack_destroy(rs);
+}
+
+static void program_test_compile()
+{
+	static const int expected[] = { 4, 3, 2, 1, 2 };
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	int i;
+
+	program_test_context_init(&ctx);
+	program = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	CU_ASSERT_EQUAL(gravm_program_size(program), ARRAY_SIZE(program_test_edges));
+
+	program_test_run(program, &ctx);
+	CU_ASSERT_EQUAL_FATAL(ctx.n_trace, ARRAY_SIZE(expected));
+	for(i = 0; i < ARRAY_SIZE(expected); i++)
+		CU_ASSERT_EQUAL(ctx.trace[i], expected[i]);
+
+	gravm_program_destroy(program);
+}
+
+static void program_test_save_map()
+{
+	program_test_context_t ctx;
+	program_test_context_t ctx_mapped;
+	gravm_program_t *program;
+	gravm_program_t *mapped;
+	char path[] = "/tmp/gravmtest-XXXXXX";
+	int fd;
+	int ret;
+	int i;
+
+	program_test_context_init(&ctx);
+	program = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+
+	fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+	ret = gravm_program_save(program, fd);
+	close(fd);
+	CU_ASSERT_EQUAL(ret, 0);
+
+	mapped = gravm_program_map(path);
+	unlink(path);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(mapped);
+	CU_ASSERT_EQUAL(gravm_program_size(mapped), gravm_program_size(program));
+	CU_ASSERT_EQUAL(mapped->depth, PROGRAM_DEPTH_UNKNOWN); /* mapping does not walk the edges */
+	CU_ASSERT_EQUAL(gravm_program_max_depth(mapped), gravm_program_max_depth(program));
+
+	program_test_run(program, &ctx);
+	program_test_context_init(&ctx_mapped);
+	program_test_run(mapped, &ctx_mapped);
+	CU_ASSERT_EQUAL_FATAL(ctx.n_trace, ctx_mapped.n_trace);
+	for(i = 0; i < ctx.n_trace; i++)
+		CU_ASSERT_EQUAL(ctx.trace[i], ctx_mapped.trace[i]);
+
+	gravm_program_destroy(mapped);
+	gravm_program_destroy(program);
+}
+
+/* wide fan: root -> 1 -> {2, ..., n + 1}, spanning several paging chunks */
+static void program_test_residency()
+{
+	const int n = 4 * PAGING_CHUNK / sizeof(edge_entry_t);
+	gravm_runstack_edgedef_t *edges;
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	gravm_program_t *mapped;
+	char path[] = "/tmp/gravmtest-XXXXXX";
+	int fd;
+	int ret;
+	int i;
+
+	edges = malloc(sizeof(*edges) * (n + 1));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(edges);
+	edges[0].source = GRAVM_RS_ROOT;
+	edges[0].target = 1;
+	edges[0].priority = 0;
+	for(i = 1; i <= n; i++) {
+		edges[i].source = 1;
+		edges[i].target = i + 1;
+		edges[i].priority = 0;
+	}
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.edges = edges;
+	ctx.n_edges = n + 1;
+	program = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	CU_ASSERT_EQUAL(gravm_program_set_residency(program, PAGING_CHUNK), -EINVAL);
+
+	fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+	ret = gravm_program_save(program, fd);
+	close(fd);
+	CU_ASSERT_EQUAL(ret, 0);
+	mapped = gravm_program_map(path);
+	unlink(path);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(mapped);
+
+	CU_ASSERT_EQUAL_FATAL(gravm_program_set_residency(mapped, 2 * PAGING_CHUNK), 0);
+	CU_ASSERT_TRUE(mapped->paging->n_chunks > 4);
+	program_test_run(mapped, &ctx);
+	CU_ASSERT_EQUAL(ctx.n_trace, PROGRAM_TEST_MAX_TRACE);
+	CU_ASSERT_TRUE(mapped->paging->n_resident > 0);
+	CU_ASSERT_TRUE(mapped->paging->n_resident * mapped->paging->chunk <= 2 * PAGING_CHUNK || mapped->paging->n_resident == 1);
+
+	CU_ASSERT_EQUAL(gravm_program_set_residency(mapped, 0), 0);
+	CU_ASSERT_PTR_NULL(mapped->paging);
+	gravm_program_destroy(mapped);
+	gravm_program_destroy(program);
+	free(edges);
+}
+
+static void program_test_call()
+{
+	static const gravm_runstack_edgedef_t caller_edges[] = {
+		{ .source = GRAVM_RS_ROOT, .target = 10, .priority = 0 },
+		{ .source = 10, .target = 11, .priority = 0 }
+	};
+	static const int expected[] = { 10, 11, 4, 3, 2, 1, 2, 4, 3, 2, 1, 2 };
+	program_test_context_t ctx;
+	gravm_program_t *callee;
+	gravm_program_t *caller;
+	gravm_runstack_t *rs;
+	int i;
+
+	program_test_context_init(&ctx);
+	callee = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(callee);
+	ctx.edges = caller_edges;
+	ctx.n_edges = ARRAY_SIZE(caller_edges);
+	caller = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(caller);
+
+	CU_ASSERT_EQUAL(gravm_program_call(caller, 42, callee), -ENOENT);
+	CU_ASSERT_EQUAL(gravm_program_call(caller, 11, callee), 0);
+	CU_ASSERT_EQUAL(gravm_program_call(caller, 10, callee), 0);
+
+	/* the callee's roots run after the post edges of the calling node */
+	program_test_run(caller, &ctx);
+	CU_ASSERT_EQUAL_FATAL(ctx.n_trace, ARRAY_SIZE(expected));
+	for(i = 0; i < ARRAY_SIZE(expected); i++)
+		CU_ASSERT_EQUAL(ctx.trace[i], expected[i]);
+
+	CU_ASSERT_EQUAL(gravm_program_call(caller, 10, NULL), 0);
+	ctx.n_trace = 0;
+	program_test_run(caller, &ctx);
+	CU_ASSERT_EQUAL(ctx.n_trace, 7);
+
+	rs = gravm_runstack_new(&program_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_LEVEL_ORDER), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_prepare_program(rs, caller, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_FATAL);
+	CU_ASSERT_EQUAL(errno, -ENOTSUP);
+	gravm_runstack_destroy(rs);
+
+	gravm_program_destroy(caller);
+	gravm_program_destroy(callee);
+}
+
+/* runs node 3 once, so a program calling itself from node 3 does not recurse any further */
+static int cb_program_test_node_run_once(
+		void *data,
+		int id,
+		void *frame)
+{
+	program_test_context_t *ctx = data;
+	int i;
+
+	for(i = 0; id == 3 && i < ctx->n_trace; i++)
+		if(ctx->trace[i] == 3)
+			return GRAVM_RS_FALSE;
+	return cb_program_test_node_run(data, id, frame);
+}
+
+/* the edge mask applies to the runstack's own execution of its program, not to a call of the same program */
+static void program_test_self_call()
+{
+	static const gravm_runstack_edgedef_t edges[] = {
+		{ .source = GRAVM_RS_ROOT, .target = 1, .priority = 0 },
+		{ .source = GRAVM_RS_ROOT, .target = 2, .priority = 1 },
+		{ .source = 1, .target = 3, .priority = 0 }
+	};
+	static const uint64_t mask[] = { (1 << 0) | (1 << 2) }; /* disables root -> 2 */
+	static const int expected[] = { 1, 3, 1, 2 };
+	gravm_runstack_callback_t cb = program_test_cb;
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	gravm_runstack_t *rs;
+	int i;
+
+	cb.node_run = cb_program_test_node_run_once;
+	program_test_context_init(&ctx);
+	ctx.edges = edges;
+	ctx.n_edges = ARRAY_SIZE(edges);
+	program = gravm_program_new(&cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	CU_ASSERT_EQUAL(gravm_program_call(program, 3, program), 0);
+
+	rs = gravm_runstack_new(&cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare_program(rs, program, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_edge_mask(rs, mask), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL_FATAL(ctx.n_trace, ARRAY_SIZE(expected));
+	for(i = 0; i < ARRAY_SIZE(expected); i++)
+		CU_ASSERT_EQUAL(ctx.trace[i], expected[i]);
+
+	gravm_runstack_destroy(rs);
+	CU_ASSERT_EQUAL(gravm_program_call(program, 3, NULL), 0);
+	gravm_program_destroy(program);
+}
+
+static void program_test_map_invalid()
+{
+	static const char garbage[256] = "this is not a compiled program";
+	char path[] = "/tmp/gravmtest-XXXXXX";
+	gravm_program_t *mapped;
+	int fd;
+
+	fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+	CU_ASSERT_EQUAL(write(fd, garbage, sizeof(garbage)), sizeof(garbage));
+	close(fd);
+
+	mapped = gravm_program_map(path);
+	unlink(path);
+	CU_ASSERT_PTR_NULL(mapped);
+	CU_ASSERT_EQUAL(errno, -EINVAL);
+}
+
+static void program_test_share()
+{
+	program_test_context_t ctx;
+	program_test_context_t ctx_shared;
+	gravm_program_t *program;
+	gravm_program_t *shared;
+	gravm_program_t *attached;
+	int i;
+
+	program_test_context_init(&ctx);
+	program = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	CU_ASSERT_EQUAL(gravm_program_fd(program), -ENOENT);
+
+	shared = gravm_program_share(program);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(shared);
+	CU_ASSERT(gravm_program_fd(shared) >= 0);
+	program_test_run(program, &ctx);
+	gravm_program_destroy(program);
+
+	attached = gravm_program_attach(gravm_program_fd(shared));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(attached);
+	CU_ASSERT_EQUAL(gravm_program_size(attached), gravm_program_size(shared));
+	gravm_program_destroy(shared);
+
+	program_test_context_init(&ctx_shared);
+	program_test_run(attached, &ctx_shared);
+	CU_ASSERT_EQUAL_FATAL(ctx.n_trace, ctx_shared.n_trace);
+	for(i = 0; i < ctx.n_trace; i++)
+		CU_ASSERT_EQUAL(ctx.trace[i], ctx_shared.trace[i]);
+
+	gravm_program_destroy(attached);
+}
+
+static void program_test_check_trace(
+		const program_test_context_t *ctx,
+		const int *expected,
+		int n)
+{
+	int i;
+
+	CU_ASSERT_EQUAL_FATAL(ctx->n_trace, n);
+	for(i = 0; i < n; i++)
+		CU_ASSERT_EQUAL(ctx->trace[i], expected[i]);
+}
+
+/* every edge can be found by its id */
+static void program_test_check_ids(
+		gravm_program_t *program)
+{
+	int i;
+
+	CU_ASSERT_EQUAL_FATAL(program_commit(program), 0);
+	for(i = 0; i < program->n_edges; i++)
+		CU_ASSERT_EQUAL(program_find(program, program_edge(program, i)->id), i);
+	CU_ASSERT_EQUAL(program_find(program, -1), -ENOENT);
+}
+
+static void program_test_mutate()
+{
+	static const gravm_runstack_edgedef_t add_pre = { .source = 4, .target = 5, .priority = -1 };
+	static const gravm_runstack_edgedef_t add_root = { .source = GRAVM_RS_ROOT, .target = 6, .priority = -1 };
+	static const int expected_add[] = { 6, 5, 4, 3, 2, 1, 2 };
+	static const int expected_remove[] = { 6, 5, 4, 3, 1, 2 };
+	program_test_context_t ctx;
+	gravm_runstack_t *rs;
+	int ret;
+
+	program_test_context_init(&ctx);
+	rs = gravm_runstack_new(&program_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	ret = gravm_runstack_prepare(rs, &ctx);
+	CU_ASSERT_EQUAL_FATAL(ret, 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 5, &add_pre), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 6, &add_root), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 6, &add_root), -EEXIST);
+	CU_ASSERT_EQUAL(gravm_program_size(gravm_runstack_program(rs)), ARRAY_SIZE(program_test_edges) + 2);
+	program_test_check_ids(gravm_runstack_program(rs));
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected_add, ARRAY_SIZE(expected_add));
+
+	CU_ASSERT_EQUAL(gravm_runstack_edge_remove(rs, 4), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_remove(rs, 4), -ENOENT);
+	program_test_check_ids(gravm_runstack_program(rs));
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected_remove, ARRAY_SIZE(expected_remove));
+
+	CU_ASSERT_EQUAL(gravm_runstack_edge_remove(rs, 0), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_remove(rs, 3), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_remove(rs, 6), -EINVAL); /* last root edge */
+
+	gravm_runstack_destroy(rs);
+}
+
+static void program_test_layout_dfs()
+{
+	static const gravm_runstack_edgedef_t edges[] = {
+		{ .source = GRAVM_RS_ROOT, .target = 5, .priority = 0 },
+		{ .source = 1, .target = 2, .priority = 0 },
+		{ .source = 5, .target = 1, .priority = 0 },
+		{ .source = 2, .target = 3, .priority = 0 }
+	};
+	static const gravm_runstack_edgedef_t add_pre = { .source = 5, .target = 4, .priority = -1 };
+	static const gravm_runstack_edgedef_t add_new = { .source = 2, .target = 6, .priority = 1 };
+	static const int expected_ids[] = { 0, 2, 1, 3 };
+	static const int expected[] = { 5, 1, 2, 3 };
+	static const int expected_add[] = { 4, 5, 1, 2, 3, 6 };
+	static const int expected_remove[] = { 4, 5, 1 };
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	gravm_runstack_t *rs;
+	int i;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.edges = edges;
+	ctx.n_edges = ARRAY_SIZE(edges);
+	rs = gravm_runstack_new(&program_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	gravm_runstack_set_program_flags(rs, GRAVM_PROGRAM_LAYOUT_DFS);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+
+	/* blocks in visiting order: root, 5, 1, 2 */
+	program = gravm_runstack_program(rs);
+	CU_ASSERT_EQUAL_FATAL(program->n_edges, ARRAY_SIZE(expected_ids));
+	for(i = 0; i < ARRAY_SIZE(expected_ids); i++)
+		CU_ASSERT_EQUAL(program_edge(program, i)->id, expected_ids[i]);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 4, &add_pre), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 5, &add_new), 0);
+	program_test_check_ids(program);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected_add, ARRAY_SIZE(expected_add));
+
+	CU_ASSERT_EQUAL(gravm_runstack_edge_remove(rs, 1), 0);
+	program_test_check_ids(program);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected_remove, ARRAY_SIZE(expected_remove));
+
+	gravm_runstack_destroy(rs);
+}
+
+static void program_test_relayout()
+{
+	static const unsigned int counts[] = { 1, 0, 1, 0, 7 };
+	static const int expected[] = { 4, 3, 2, 1, 2 };
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	gravm_runstack_t *rs;
+
+	program_test_context_init(&ctx);
+	rs = gravm_runstack_new(&program_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+
+	/* node 3 (edge 4) is the hottest, followed by the root and node 1 */
+	CU_ASSERT_EQUAL(gravm_runstack_relayout(rs, counts, ARRAY_SIZE(counts)), 0);
+	program = gravm_runstack_program(rs);
+	CU_ASSERT_EQUAL(program_edge(program, 0)->id, 4);
+	CU_ASSERT_EQUAL(program_node(program, 3)->lower, 0);
+	CU_ASSERT_EQUAL(program_node(program, GRAVM_RS_ROOT)->lower, 1);
+	CU_ASSERT_EQUAL(program_node(program, 1)->lower, 3);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+
+	gravm_runstack_destroy(rs);
+}
+
+static int cb_program_test_edge_payload(
+		void *data,
+		int edge,
+		void *payload)
+{
+	*(long*)payload = edge * 10 + 1;
+	return 0;
+}
+
+static int cb_program_test_node_payload(
+		void *data,
+		int node,
+		void *payload)
+{
+	*(long*)payload = node * 100 + 2;
+	return 0;
+}
+
+static void program_test_check_payload(
+		program_test_context_t *ctx,
+		long expected,
+		const long *payload)
+{
+	ctx->payload_checks++;
+	if(payload == NULL || *payload != expected)
+		ctx->payload_errors++;
+}
+
+static int cb_program_test_payload_edge_prepare(
+		void *data,
+		int id,
+		void *context)
+{
+	program_test_context_t *ctx = data;
+	program_test_check_payload(ctx, id * 10 + 1, gravm_runstack_edge_payload(ctx->rs));
+	return GRAVM_RS_SUCCESS;
+}
+
+static int cb_program_test_payload_edge_begin(
+		void *data,
+		int id,
+		void *context)
+{
+	program_test_context_t *ctx = data;
+	program_test_check_payload(ctx, id * 10 + 1, gravm_runstack_edge_payload(ctx->rs));
+	return GRAVM_RS_TRUE;
+}
+
+static int cb_program_test_payload_node_run(
+		void *data,
+		int id,
+		void *frame)
+{
+	program_test_context_t *ctx = data;
+	program_test_check_payload(ctx, id * 100 + 2, gravm_runstack_node_payload(ctx->rs));
+	return cb_program_test_node_run(data, id, frame);
+}
+
+static void program_test_payload()
+{
+	static const gravm_runstack_edgedef_t add = { .source = 2, .target = 7, .priority = 0 };
+	static const int expected[] = { 4, 3, 2, 7, 1, 2, 7 };
+	gravm_runstack_callback_t cb = program_test_cb;
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	gravm_program_t *mapped;
+	char path[] = "/tmp/gravm-payload-XXXXXX";
+	int fd;
+
+	cb.edge_prepare = cb_program_test_payload_edge_prepare;
+	cb.edge_begin = cb_program_test_payload_edge_begin;
+	cb.node_run = cb_program_test_payload_node_run;
+	cb.edge_payload = cb_program_test_edge_payload;
+	cb.node_payload = cb_program_test_node_payload;
+
+	program_test_context_init(&ctx);
+	ctx.rs = gravm_runstack_new_payload(&cb, -1, 0, sizeof(long), sizeof(long));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(ctx.rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(ctx.rs, &ctx), 0);
+	program = gravm_runstack_program(ctx.rs);
+	CU_ASSERT_EQUAL(gravm_program_edge_payload_size(program), sizeof(long));
+	CU_ASSERT_EQUAL(gravm_program_node_payload_size(program), sizeof(long));
+
+	/* new edge and new node get their payloads as well */
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(ctx.rs, 5, &add), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(ctx.rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+	CU_ASSERT(ctx.payload_checks > ARRAY_SIZE(expected));
+	CU_ASSERT_EQUAL(ctx.payload_errors, 0);
+
+	/* payloads are part of the saved program */
+	fd = mkstemp(path);
+	CU_ASSERT_FATAL(fd >= 0);
+	unlink(path);
+	CU_ASSERT_EQUAL(gravm_program_save(program, fd), 0);
+	mapped = gravm_program_attach(fd);
+	close(fd);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(mapped);
+	CU_ASSERT_EQUAL(gravm_runstack_prepare_program(ctx.rs, mapped, &ctx), 0);
+	ctx.n_trace = 0;
+	ctx.payload_checks = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(ctx.rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+	CU_ASSERT(ctx.payload_checks > ARRAY_SIZE(expected));
+	CU_ASSERT_EQUAL(ctx.payload_errors, 0);
+
+	gravm_runstack_destroy(ctx.rs);
+	gravm_program_destroy(mapped);
+}
+
+static int cb_program_test_edge_payload_fail(
+		void *data,
+		int edge,
+		void *payload)
+{
+	if(edge == 9)
+		return -EIO;
+	return cb_program_test_edge_payload(data, edge, payload);
+}
+
+static void program_test_payload_fail()
+{
+	static const gravm_runstack_edgedef_t add = { .source = 2, .target = 7, .priority = 0 };
+	static const int expected[] = { 4, 3, 2, 1, 2 };
+	gravm_runstack_callback_t cb = program_test_cb;
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	gravm_runstack_t *rs;
+
+	cb.edge_payload = cb_program_test_edge_payload_fail;
+	program_test_context_init(&ctx);
+	rs = gravm_runstack_new_payload(&cb, -1, 0, sizeof(long), 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_set_options(rs, GRAVM_RS_OPT_INCREMENTAL), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+
+	/* the failed edge is gone; the run is complete again as the program may have changed */
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 9, &add), -EIO);
+	program = gravm_runstack_program(rs);
+	CU_ASSERT_EQUAL(gravm_program_size(program), ARRAY_SIZE(program_test_edges));
+	CU_ASSERT_EQUAL(program_find(program, 9), -ENOENT);
+	program_test_check_ids(program);
+	CU_ASSERT_EQUAL(gravm_runstack_debug_state(rs), GRAVM_RS_STATE_PREPARED);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected, ARRAY_SIZE(expected));
+
+	/* nothing dirty */
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	CU_ASSERT_EQUAL(ctx.n_trace, 0);
+
+	gravm_runstack_destroy(rs);
+}
+
+static void program_test_mutate_shared()
+{
+	static const gravm_runstack_edgedef_t def = { .source = 4, .target = 5, .priority = 0 };
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	gravm_runstack_t *rs;
+
+	program_test_context_init(&ctx);
+	program = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	rs = gravm_runstack_new(&program_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 5, &def), -EINVAL);
+	CU_ASSERT_EQUAL(gravm_runstack_prepare_program(rs, program, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 5, &def), -EPERM);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_remove(rs, 0), -EPERM);
+
+	gravm_runstack_destroy(rs);
+	gravm_program_destroy(program);
+}
+
+static void program_test_slot()
+{
+	static const gravm_runstack_edgedef_t edges_v2[] = {
+		{ .source = GRAVM_RS_ROOT, .target = 7, .priority = 0 }
+	};
+	static const int expected_v1[] = { 4, 3, 2, 1, 2 };
+	static const int expected_v2[] = { 7 };
+	program_test_context_t ctx;
+	gravm_program_t *v1;
+	gravm_program_t *v2;
+	gravm_program_slot_t *slot;
+	gravm_runstack_t *rs;
+
+	program_test_context_init(&ctx);
+	v1 = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(v1);
+	ctx.edges = edges_v2;
+	ctx.n_edges = ARRAY_SIZE(edges_v2);
+	v2 = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(v2);
+	slot = gravm_program_slot_new(v1);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(slot);
+
+	rs = gravm_runstack_new(&program_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL(gravm_runstack_prepare_slot(rs, slot, &ctx), 0);
+	CU_ASSERT(gravm_runstack_program(rs) == v1);
+
+	/* publish while executing: the running execution continues on v1 */
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_step(rs), GRAVM_RS_TRUE);
+	CU_ASSERT_EQUAL(gravm_program_slot_publish(slot, v2), 0);
+	CU_ASSERT_EQUAL(gravm_program_slot_reclaim(slot), 1);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected_v1, ARRAY_SIZE(expected_v1));
+
+	/* reset picks up v2, v1 can be reclaimed */
+	CU_ASSERT_EQUAL(gravm_runstack_reset(rs), 0);
+	CU_ASSERT(gravm_runstack_program(rs) == v2);
+	CU_ASSERT_EQUAL(gravm_program_slot_reclaim(slot), 0);
+	ctx.n_trace = 0;
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	program_test_check_trace(&ctx, expected_v2, ARRAY_SIZE(expected_v2));
+
+	gravm_runstack_destroy(rs);
+	gravm_program_slot_destroy(slot);
+}
+
+/* pseudo-random graph with enough edges to be split across several threads */
+static gravm_runstack_edgedef_t *program_test_random_edges(
+		int n)
+{
+	gravm_runstack_edgedef_t *edges;
+	unsigned int state = 12345;
+	int i;
+
+	edges = calloc(n, sizeof(*edges));
+	for(i = 0; i < n; i++) {
+		state = state * 1103515245 + 12345;
+		edges[i].source = (int)((state >> 8) % 1000) - 1;
+		state = state * 1103515245 + 12345;
+		edges[i].target = (int)((state >> 8) % 1200);
+		state = state * 1103515245 + 12345;
+		edges[i].priority = (int)((state >> 8) % 5) - 2;
+	}
+	return edges;
+}
+
+static void program_test_parallel()
+{
+	static const int flags[] = {
+		GRAVM_PROGRAM_PARALLEL,
+		GRAVM_PROGRAM_PARALLEL | GRAVM_PROGRAM_STRUCTURE_THREADSAFE };
+	const int n = 3 * GRAVM_PROGRAM_MIN_SHARD + 17;
+	gravm_runstack_edgedef_t *edges;
+	program_test_context_t ctx;
+	gravm_program_t *reference;
+	gravm_program_t *program;
+	int i;
+
+	edges = program_test_random_edges(n);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(edges);
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.edges = edges;
+	ctx.n_edges = n;
+
+	reference = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(reference);
+	CU_ASSERT_EQUAL(gravm_program_size(reference), n);
+	for(i = 0; i < ARRAY_SIZE(flags); i++) {
+		program = gravm_program_new(&program_test_cb, &ctx, flags[i]);
+		CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+		CU_ASSERT_EQUAL_FATAL(program->n_edges, reference->n_edges);
+		CU_ASSERT_EQUAL_FATAL(program->n_nodes, reference->n_nodes);
+		CU_ASSERT(memcmp(program->edges, reference->edges, program->edge_stride * n) == 0);
+		CU_ASSERT(memcmp(program->nodes, reference->nodes, program->node_stride * program->n_nodes) == 0);
+		gravm_program_destroy(program);
+	}
+
+	gravm_program_destroy(reference);
+	free(edges);
+}
+
+/* each node's block holds its edges sorted like a compiled program, the blocks cover the edge array */
+static void program_test_check_blocks(
+		gravm_program_t *program)
+{
+	const range_t *range;
+	int total = 0;
+	int node;
+	int i;
+
+	for(node = GRAVM_RS_ROOT; node + 1 < program->n_nodes; node++) {
+		range = program_node(program, node);
+		CU_ASSERT_FATAL(range->lower <= range->boundary && range->boundary <= range->upper);
+		total += range->upper - range->lower;
+		for(i = range->lower; i < range->upper; i++) {
+			CU_ASSERT_EQUAL(program_edge(program, i)->source, node);
+			CU_ASSERT_EQUAL(program_edge(program, i)->priority < 0, i < range->boundary);
+			if(i > range->lower)
+				CU_ASSERT(cmp_full(program_edge(program, i - 1), program_edge(program, i)) < 0);
+		}
+	}
+	CU_ASSERT_EQUAL(total, program->n_edges);
+}
+
+/* random edits in batches, each batch applied by a single commit */
+static void program_test_edit_batches()
+{
+	const int n = 2000;
+	const int n_ops = 6000;
+	gravm_runstack_edgedef_t *edges;
+	gravm_runstack_edgedef_t def;
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	unsigned int state = 4711;
+	bool *live;
+	int n_live = n;
+	int id;
+	int op;
+	int ret;
+	int i;
+
+	edges = program_test_random_edges(n);
+	live = malloc(sizeof(bool) * (n + n_ops));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(edges);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(live);
+	edges[0].source = GRAVM_RS_ROOT;
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.edges = edges;
+	ctx.n_edges = n;
+	program = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	for(i = 0; i < n + n_ops; i++)
+		live[i] = i < n;
+
+	for(op = 0; op < n_ops; op++) {
+		state = state * 1103515245 + 12345;
+		id = (int)((state >> 8) % (n + op + 1));
+		if(live[id]) {
+			ret = program_edge_remove(program, id);
+			if(ret == -EINVAL) /* last root edge */
+				continue;
+			CU_ASSERT_EQUAL_FATAL(ret, 0);
+			CU_ASSERT_EQUAL(program_edge_remove(program, id), -ENOENT);
+			live[id] = false;
+			n_live--;
+		}
+		else {
+			state = state * 1103515245 + 12345;
+			def.source = (int)((state >> 8) % 1300) - 1;
+			state = state * 1103515245 + 12345;
+			def.target = (int)((state >> 8) % 1300);
+			def.priority = (int)(state % 5) - 2;
+			CU_ASSERT_EQUAL_FATAL(program_edge_insert(program, id, &def, &program_test_cb, &ctx), 0);
+			CU_ASSERT_EQUAL(program_edge_insert(program, id, &def, &program_test_cb, &ctx), -EEXIST);
+			live[id] = true;
+			n_live++;
+		}
+		CU_ASSERT_EQUAL(gravm_program_size(program), n_live);
+
+		if(op % 1000 == 999) {
+			CU_ASSERT_EQUAL_FATAL(program_commit(program), 0);
+			CU_ASSERT_EQUAL_FATAL(program->n_edges, n_live);
+			program_test_check_blocks(program);
+			program_test_check_ids(program);
+			for(i = 0; i < n + n_ops; i++)
+				CU_ASSERT_EQUAL(program_find(program, i) >= 0, live[i]);
+		}
+	}
+
+	gravm_program_destroy(program);
+	free(live);
+	free(edges);
+}
+
+static void program_test_invalid_node()
+{
+	static const gravm_runstack_edgedef_t edges[] = {
+		{ .source = GRAVM_RS_ROOT, .target = 1, .priority = 0 },
+		{ .source = 1, .target = -5, .priority = 0 }
+	};
+	program_test_context_t ctx;
+	gravm_program_t *program;
+
+	memset(&ctx, 0, sizeof(ctx));
+	ctx.edges = edges;
+	ctx.n_edges = ARRAY_SIZE(edges);
+	program = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NULL(program);
+	CU_ASSERT_EQUAL(errno, -EINVAL);
+}
+
+static void program_test_max_depth()
+{
+	static const gravm_runstack_edgedef_t add_deeper = { .source = 2, .target = 5, .priority = 0 };
+	static const gravm_runstack_edgedef_t add_cycle = { .source = 5, .target = 1, .priority = 0 };
+	program_test_context_t ctx;
+	gravm_program_t *program;
+	gravm_runstack_t *rs;
+
+	program_test_context_init(&ctx);
+	program = gravm_program_new(&program_test_cb, &ctx, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	CU_ASSERT_EQUAL(program->depth, PROGRAM_DEPTH_UNKNOWN);
+	CU_ASSERT_EQUAL(gravm_program_max_depth(program), 3); /* root -> 1 -> 3 -> 2 */
+	CU_ASSERT_EQUAL(program->depth, 3);
+	gravm_program_destroy(program);
+
+	rs = gravm_runstack_new(&program_test_cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL(gravm_runstack_max_depth(rs), -EINVAL);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, &ctx), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_max_depth(rs), 3);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 5, &add_deeper), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_program(rs)->depth, PROGRAM_DEPTH_UNKNOWN); /* invalidated, not recomputed */
+	CU_ASSERT_EQUAL(gravm_runstack_max_depth(rs), 4);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_add(rs, 6, &add_cycle), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_max_depth(rs), -ELOOP);
+	CU_ASSERT_EQUAL(gravm_runstack_edge_remove(rs, 6), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_max_depth(rs), 4);
+	gravm_runstack_destroy(rs);
+}
+
+int gravmtest_program()
+{
+	CU_pSuite suite;
+	CU_pTest test;
+
+	memset(&program_test_cb, 0, sizeof(program_test_cb));
+	program_test_cb.init = cb_program_test_init;
+	program_test_cb.structure = cb_program_test_structure;
+	program_test_cb.node_run = cb_program_test_node_run;
+
+	BEGIN_SUITE("Program", NULL, NULL);
+		ADD_TEST("compile and run", program_test_compile);
+		ADD_TEST("save and map", program_test_save_map);
+		ADD_TEST("map invalid file", program_test_map_invalid);
+		ADD_TEST("bounded residency", program_test_residency);
+		ADD_TEST("shared memory", program_test_share);
+		ADD_TEST("add/remove edges", program_test_mutate);
+		ADD_TEST("add/remove edges on foreign program", program_test_mutate_shared);
+		ADD_TEST("versioning", program_test_slot);
+		ADD_TEST("parallel compilation", program_test_parallel);
+		ADD_TEST("depth-first layout", program_test_layout_dfs);
+		ADD_TEST("profile-guided layout", program_test_relayout);
+		ADD_TEST("edge and node payloads", program_test_payload);
+		ADD_TEST("failing edge payload", program_test_payload_fail);
+		ADD_TEST("batched edits", program_test_edit_batches);
+		ADD_TEST("invalid node id", program_test_invalid_node);
+		ADD_TEST("maximum depth", program_test_max_depth);
+		ADD_TEST("calling programs", program_test_call);
+		ADD_TEST("program calling itself", program_test_self_call);
+	END_SUITE;
+
+	return 0;
+}
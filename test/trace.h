@@ -0,0 +1,203 @@
+#include <string.h>
+#include <stdlib.h>
+#include <pthread.h>
+
+#include "common.h"
+
+#include <gravm/program.h>
+
+#ifndef ARRAY_SIZE
+#define ARRAY_SIZE(X) (sizeof(X) / sizeof(*(X)))
+#endif
+
+#define TRACE_TEST_RECORDS 100000
+
+static void *trace_test_producer(
+		void *data)
+{
+	int i;
+
+	for(i = 0; i < TRACE_TEST_RECORDS; i++)
+		trace_write(data, -1, i, 0, 0, 0);
+	return NULL;
+}
+
+static void trace_test_ring()
+{
+	gravm_trace_record_t records[8];
+	gravm_trace_t *trace;
+	int i;
+
+	CU_ASSERT_PTR_NULL(gravm_trace_new(0));
+	trace = gravm_trace_new(3);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(trace);
+	CU_ASSERT_EQUAL(trace->mask, 3);
+	CU_ASSERT_EQUAL(gravm_trace_read(trace, records, ARRAY_SIZE(records)), 0);
+	CU_ASSERT_EQUAL(gravm_trace_read(trace, records, -1), -EINVAL);
+
+	for(i = 0; i < 6; i++)
+		trace_write(trace, -1, i, i + 1, GRAVM_RS_IP_NODE_RUN, GRAVM_RS_STATE_EXECUTING);
+	CU_ASSERT_EQUAL(gravm_trace_dropped(trace), 2);
+	CU_ASSERT_EQUAL(gravm_trace_read(trace, records, -1), -EINVAL); /* nothing consumed */
+	CU_ASSERT_EQUAL(gravm_trace_read(trace, records, 0), 0);
+	CU_ASSERT_EQUAL(gravm_trace_read(trace, records, 1), 1);
+	CU_ASSERT_EQUAL(records[0].edge, 0);
+	CU_ASSERT_EQUAL(records[0].node, 1);
+	CU_ASSERT_EQUAL(records[0].ip, GRAVM_RS_IP_NODE_RUN);
+	CU_ASSERT_EQUAL(records[0].state, GRAVM_RS_STATE_EXECUTING);
+
+	/* wraps around */
+	trace_write(trace, -1, 6, 0, 0, 0);
+	CU_ASSERT_EQUAL(gravm_trace_read(trace, records, ARRAY_SIZE(records)), 4);
+	for(i = 0; i < 3; i++)
+		CU_ASSERT_EQUAL(records[i].edge, i + 1);
+	CU_ASSERT_EQUAL(records[3].edge, 6);
+	CU_ASSERT(records[0].time <= records[3].time);
+	gravm_trace_destroy(trace);
+}
+
+static void trace_test_concurrent()
+{
+	gravm_trace_record_t records[64];
+	gravm_trace_t *trace;
+	pthread_t producer;
+	int last = -1;
+	int n_read = 0;
+	bool done = false;
+	int n;
+	int i;
+
+	trace = gravm_trace_new(256);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(trace);
+	CU_ASSERT_EQUAL_FATAL(pthread_create(&producer, NULL, trace_test_producer, trace), 0);
+	while(!done) {
+		done = last == TRACE_TEST_RECORDS - 1 || n_read + gravm_trace_dropped(trace) == TRACE_TEST_RECORDS;
+		n = gravm_trace_read(trace, records, ARRAY_SIZE(records));
+		for(i = 0; i < n; i++) {
+			CU_ASSERT(records[i].edge > last);
+			last = records[i].edge;
+		}
+		n_read += n;
+		if(n > 0)
+			done = false;
+	}
+	pthread_join(producer, NULL);
+	n_read += gravm_trace_read(trace, records, ARRAY_SIZE(records));
+	CU_ASSERT_EQUAL(n_read + gravm_trace_dropped(trace), TRACE_TEST_RECORDS);
+	gravm_trace_destroy(trace);
+}
+
+static int cb_trace_test_init(
+		void *data)
+{
+	return 1;
+}
+
+static int cb_trace_test_structure(
+		void *data,
+		int edge,
+		gravm_runstack_edgedef_t *def)
+{
+	def->source = GRAVM_RS_ROOT;
+	def->target = 7;
+	def->priority = 0;
+	return 0;
+}
+
+static void trace_test_runstack()
+{
+	gravm_trace_record_t records[64];
+	gravm_runstack_callback_t cb;
+	gravm_runstack_t *rs;
+	gravm_trace_t *trace;
+	int n;
+
+	memset(&cb, 0, sizeof(cb));
+	cb.init = cb_trace_test_init;
+	cb.structure = cb_trace_test_structure;
+	trace = gravm_trace_new(ARRAY_SIZE(records));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(trace);
+	rs = gravm_runstack_new(&cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL_FATAL(gravm_runstack_prepare(rs, NULL), 0);
+#ifdef GRAVM_TRACE
+	CU_ASSERT_EQUAL(gravm_runstack_set_trace(rs, trace), 0);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	n = gravm_trace_read(trace, records, ARRAY_SIZE(records));
+	CU_ASSERT_FATAL(n > 0);
+	CU_ASSERT_EQUAL(records[0].edge, 0);
+	CU_ASSERT_EQUAL(records[0].node, 7);
+	CU_ASSERT_EQUAL(records[0].ip, GRAVM_RS_IP_DESCEND);
+	CU_ASSERT_EQUAL(records[n - 1].ip, GRAVM_RS_IP_POP);
+	CU_ASSERT_EQUAL(records[n - 1].state, GRAVM_RS_STATE_EXECUTING);
+	CU_ASSERT_EQUAL(records[n - 1].lane, -1);
+	CU_ASSERT_EQUAL(gravm_runstack_set_trace(rs, NULL), 0);
+#else
+	CU_ASSERT_EQUAL(gravm_runstack_set_trace(rs, trace), -ENOTSUP);
+	CU_ASSERT_EQUAL(gravm_runstack_run(rs), GRAVM_RS_SUCCESS);
+	n = gravm_trace_read(trace, records, ARRAY_SIZE(records));
+	CU_ASSERT_EQUAL(n, 0);
+#endif
+	gravm_runstack_destroy(rs);
+	gravm_trace_destroy(trace);
+}
+
+#ifdef GRAVM_TRACE
+/* the lanes of a batch write into the trace of the runstack running it */
+static void trace_test_batch()
+{
+	void *const users[] = { NULL, NULL };
+	gravm_trace_record_t records[64];
+	gravm_runstack_callback_t cb;
+	gravm_program_t *program;
+	gravm_runstack_t *rs;
+	gravm_trace_t *trace;
+	int results[ARRAY_SIZE(users)];
+	int per_lane[ARRAY_SIZE(users)];
+	int n;
+	int i;
+
+	memset(&cb, 0, sizeof(cb));
+	cb.init = cb_trace_test_init;
+	cb.structure = cb_trace_test_structure;
+	trace = gravm_trace_new(ARRAY_SIZE(records));
+	CU_ASSERT_PTR_NOT_NULL_FATAL(trace);
+	program = gravm_program_new(&cb, NULL, GRAVM_PROGRAM_DEFAULT);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(program);
+	rs = gravm_runstack_new(&cb, -1, 0);
+	CU_ASSERT_PTR_NOT_NULL_FATAL(rs);
+	CU_ASSERT_EQUAL(gravm_runstack_set_trace(rs, trace), 0);
+
+	CU_ASSERT_EQUAL(gravm_runstack_run_batch(rs, program, users, ARRAY_SIZE(users), results), GRAVM_RS_SUCCESS);
+	n = gravm_trace_read(trace, records, ARRAY_SIZE(records));
+	memset(per_lane, 0, sizeof(per_lane));
+	for(i = 0; i < n; i++) {
+		CU_ASSERT_FATAL(records[i].lane >= 0 && records[i].lane < ARRAY_SIZE(users));
+		CU_ASSERT_EQUAL(records[i].node, 7);
+		per_lane[records[i].lane]++;
+	}
+	CU_ASSERT(per_lane[0] > 0);
+	CU_ASSERT_EQUAL(per_lane[0], per_lane[1]);
+
+	gravm_runstack_destroy(rs);
+	gravm_program_destroy(program);
+	gravm_trace_destroy(trace);
+}
+#endif
+
+int gravmtest_trace()
+{
+	CU_pSuite suite;
+	CU_pTest test;
+
+	BEGIN_SUITE("Trace", NULL, NULL);
+		ADD_TEST("ring", trace_test_ring);
+		ADD_TEST("concurrent producer and consumer", trace_test_concurrent);
+		ADD_TEST("runstack", trace_test_runstack);
+#ifdef GRAVM_TRACE
+		ADD_TEST("batch lanes", trace_test_batch);
+#endif
+	END_SUITE;
+
+	return 0;
+}